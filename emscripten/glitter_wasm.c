@@ -18,11 +18,24 @@
 
 #include "lightanchor.h"
 #include "lightanchor_detector.h"
+#include "result_ring.h"
+#include "gray_convert.h"
 
 apriltag_family_t *lf = NULL;
 apriltag_detector_t *td = NULL;
 lightanchor_detector_t *ld = NULL;
 
+// results of the last RESULT_SLOTS frames, read in place by glitter-module.js
+#define RESULT_SLOTS        4
+#define RESULT_CAPACITY     256
+result_ring_t *results = NULL;
+
+// also dispatch one onGlitterTagFound/onGlitterTagLost event per record
+int tag_events = 0;
+
+// see enum gray_mode, the preprocessor's shader leaves its gray value in red
+int gray_mode = GRAY_RED;
+
 EMSCRIPTEN_KEEPALIVE
 int init()
 {
@@ -40,6 +53,8 @@ int init()
     if (ld == NULL)
         return -1;
 
+    results = result_ring_create(RESULT_SLOTS, RESULT_CAPACITY);
+
     td->nthreads = 1;
     td->quad_decimate = 1.0;
 
@@ -65,11 +80,17 @@ int init()
 }
 
 EMSCRIPTEN_KEEPALIVE
-int add_code(char code)
+int add_code(uint32_t code)
 {
     return lightanchor_detector_add_code(ld, code);
 }
 
+EMSCRIPTEN_KEEPALIVE
+int set_code_width(int width)
+{
+    return lightanchor_detector_set_code_width(ld, width);
+}
+
 EMSCRIPTEN_KEEPALIVE
 int set_detector_options(int range_thres, int min_white_black_diff, int ttl_frames,
                         double thres_dist_shape, double thres_dist_shape_ttl, double thres_dist_center)
@@ -91,52 +112,136 @@ int set_quad_decimate(float quad_decimate)
 }
 
 EMSCRIPTEN_KEEPALIVE
-int save_grayscale(uint8_t pixels[], uint8_t gray[], int cols, int rows)
+int set_roi_tracking(int enable, int full_every, int pad)
 {
-    const int len = cols * rows * 4;
-    for (int i = 0, j = 0; i < len; i+=4, j++)
-    {
-        gray[j] = pixels[i];
-    }
+    ld->track_roi = enable;
+    ld->roi_full_every = full_every;
+    ld->roi_pad = pad;
     return 0;
 }
 
 EMSCRIPTEN_KEEPALIVE
-int detect_tags(uint8_t gray[], int cols, int rows)
+int set_gray_mode(int mode)
 {
-    image_u8_t im = {
+    gray_mode = mode;
+    return 0;
+}
+
+/* gray copy of a frame with `channels` bytes per pixel and rows `stride` bytes apart */
+EMSCRIPTEN_KEEPALIVE
+int save_frame(uint8_t pixels[], uint8_t gray[], int cols, int rows, int stride, int channels)
+{
+    // the frame is already decimated by the canvas it was drawn into
+    image_u8_t out = {
         .width = cols,
         .height = rows,
         .stride = cols,
         .buf = gray
     };
+    gray_convert(pixels, cols, rows, stride, channels, gray_mode, 1, &out);
+    return 0;
+}
 
-    // EM_ASM({console.time("detect_quads")});
-    zarray_t *quads = detect_quads(td, &im);
-    // EM_ASM({console.timeEnd("detect_quads")});
+EMSCRIPTEN_KEEPALIVE
+int save_grayscale(uint8_t pixels[], uint8_t gray[], int cols, int rows)
+{
+    return save_frame(pixels, gray, cols, rows, cols * 4, 4);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int set_tag_events(int enable)
+{
+    tag_events = enable;
+    return 0;
+}
 
-    // EM_ASM({console.time("decode_tags")});
-    zarray_t *lightanchors = decode_tags(td, ld, quads, &im);
-    // EM_ASM({console.timeEnd("decode_tags")});
+/* layout of the result slots, see result_ring.h */
+EMSCRIPTEN_KEEPALIVE
+int get_result_capacity()
+{
+    return results->capacity;
+}
 
-    int sz = zarray_size(lightanchors);
+EMSCRIPTEN_KEEPALIVE
+int32_t *get_results()
+{
+    return result_ring_latest(results);
+}
 
-    for (int i = 0; i < sz; i++)
+EMSCRIPTEN_KEEPALIVE
+int set_collect_stats(int enable)
+{
+    ld->collect_stats = enable;
+    return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int reset_stats()
+{
+    lightanchor_detector_reset_stats(ld);
+    return 0;
+}
+
+/* stats as doubles, which hold the 64-bit sums exactly for far longer than any session */
+EMSCRIPTEN_KEEPALIVE
+double get_stats_frames()
+{
+    return ld->stats.frames;
+}
+
+EMSCRIPTEN_KEEPALIVE
+double get_stage_ns(int stage)
+{
+    return (stage >= 0 && stage < STAGE_COUNT) ? ld->stats.ns[stage] : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+double get_counter(int counter)
+{
+    return (counter >= 0 && counter < COUNTER_COUNT) ? ld->stats.counters[counter] : 0;
+}
+
+static void dispatch_tag_events(int32_t *slot)
+{
+    int32_t *ints = result_ring_ints(results, slot);
+    double *doubles = result_ring_doubles(results, slot);
+    int n = slot[RESULT_NDETECTIONS] + slot[RESULT_NLOST];
+
+    for (int i = 0; i < n; i++)
     {
-        lightanchor_t *la;
-        zarray_get(lightanchors, i, &la);
+        int32_t *rec = &ints[i * RESULT_INTS];
+        double *pos = &doubles[i * RESULT_DOUBLES];
 
-        // adjust centers of pixels so that they correspond to the
-        // original full-resolution image.
-        if (td->quad_decimate > 1)
+        if (rec[RESULT_STATE] == LIGHTANCHOR_LOST)
         {
-            for (int j = 0; j < 4; j++)
-            {
-                la->p[j][0] = (la->p[j][0] - 0.5) * td->quad_decimate + 0.5;
-                la->p[j][1] = (la->p[j][1] - 0.5) * td->quad_decimate + 0.5;
-            }
-            la->c[0] = (la->c[0] - 0.5) * td->quad_decimate + 0.5;
-            la->c[1] = (la->c[1] - 0.5) * td->quad_decimate + 0.5;
+            EM_ASM_({
+                var $a = arguments;
+                var i = 0;
+
+                const tag = {};
+
+                tag["id"] = $a[i++];
+                tag["code"] = $a[i++];
+
+                const center = {};
+                center["x"] = $a[i++];
+                center["y"] = $a[i++];
+                tag["center"] = center;
+
+                const tagEvent = new CustomEvent("onGlitterTagLost", {detail: {tag: tag}});
+                var scope;
+                if ('function' === typeof importScripts)
+                    scope = self;
+                else
+                    scope = window;
+                scope.dispatchEvent(tagEvent);
+            },
+                (uint32_t)rec[RESULT_ID],
+                (uint32_t)rec[RESULT_CODE],
+                pos[RESULT_CX],
+                pos[RESULT_CY]
+            );
+            continue;
         }
 
         EM_ASM_({
@@ -145,6 +250,8 @@ int detect_tags(uint8_t gray[], int cols, int rows)
 
             const tag = {};
 
+            tag["id"] = $a[i++];
+            tag["acquired"] = ($a[i++] != 0);
             tag["code"] = $a[i++];
 
             tag["corners"] = [];
@@ -182,20 +289,42 @@ int detect_tags(uint8_t gray[], int cols, int rows)
                 scope = window;
             scope.dispatchEvent(tagEvent);
         },
-            la->match_code,
-            la->p[0][0],
-            la->p[0][1],
-            la->p[1][0],
-            la->p[1][1],
-            la->p[2][0],
-            la->p[2][1],
-            la->p[3][0],
-            la->p[3][1],
-            la->c[0],
-            la->c[1]
+            (uint32_t)rec[RESULT_ID],
+            rec[RESULT_STATE] == LIGHTANCHOR_ACQUIRED,
+            (uint32_t)rec[RESULT_CODE],
+            pos[RESULT_P + 0],
+            pos[RESULT_P + 1],
+            pos[RESULT_P + 2],
+            pos[RESULT_P + 3],
+            pos[RESULT_P + 4],
+            pos[RESULT_P + 5],
+            pos[RESULT_P + 6],
+            pos[RESULT_P + 7],
+            pos[RESULT_CX],
+            pos[RESULT_CY]
         );
     }
-    lightanchors_destroy(lightanchors);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int detect_tags(uint8_t gray[], int cols, int rows)
+{
+    image_u8_t im = {
+        .width = cols,
+        .height = rows,
+        .stride = cols,
+        .buf = gray
+    };
+
+    // see set_collect_stats() for timing the stages
+    zarray_t *quads = detect_quads_tracked(td, ld, &im);
+    decode_tags(td, ld, quads, &im);
+
+    // coordinates in the results are in the original full-resolution image
+    int32_t *slot = result_ring_write(results, lightanchor_detector_events(ld), td->quad_decimate);
+
+    if (tag_events)
+        dispatch_tag_events(slot);
 
-    return sz;
+    return slot[RESULT_NDETECTIONS];
 }
@@ -0,0 +1,1968 @@
+/** @file glitter_bench.c
+ *  @brief Headless micro-benchmarks for the lightanchor detector
+ *
+ *  Every stage runs on synthetic data, so no camera or image files are needed.
+ *  Stages that check a fast path against a reference exit with status 1 if
+ *  they disagree.
+ *
+ * Copyright (C) Wiselab CMU.
+ * @date July, 2020
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "apriltag.h"
+
+#include "common/getopt.h"
+#include "common/image_u8.h"
+#include "common/g2d.h"
+#include "common/math_util.h"
+#include "common/time_util.h"
+#include "common/zarray.h"
+
+#include "integral_image.h"
+#include "spatial_grid.h"
+#include "assignment.h"
+#include "queue_buf.h"
+#include "bit_match.h"
+#include "hamming_scan.h"
+#include "candidate_table.h"
+#include "result_ring.h"
+#include "gray_convert.h"
+#include "synth_sequence.h"
+
+#include "lightanchor.h"
+#include "lightanchor_detector.h"
+
+// failed equivalence checks of the stage that ran, main() exits with 1 if there were any
+static int failures;
+
+static double randf(void)
+{
+    return (double)random() / RAND_MAX;
+}
+
+static image_u8_t *noise_image(int width, int height)
+{
+    image_u8_t *im = image_u8_create(width, height);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            im->buf[y*im->stride + x] = random() & 0xff;
+    return im;
+}
+
+/* rotated square of side `size` centered at (cx, cy) */
+static void random_anchor(lightanchor_t *la, double cx, double cy, double size)
+{
+    double theta = randf() * M_PI / 2;
+    double r = size / sqrt(2);
+    memset(la, 0, sizeof(lightanchor_t));
+    for (int i = 0; i < 4; i++)
+    {
+        la->p[i][0] = cx + r*cos(theta + i*M_PI/2);
+        la->p[i][1] = cy + r*sin(theta + i*M_PI/2);
+    }
+    la->c[0] = cx;
+    la->c[1] = cy;
+    la->shape = r;
+}
+
+/* previous extract_brightness(), kept here as the reference path */
+static uint8_t extract_brightness_polygon(lightanchor_t *la, image_u8_t *im)
+{
+    int avg = 0, n = 0;
+
+    double max[2] = { 0, 0 }, min[2] = { MAX_DIST, MAX_DIST };
+    for (int i = 0; i < 4; i++)
+    {
+        max[0] = fmax(max[0], la->p[i][0]);
+        min[0] = fmin(min[0], la->p[i][0]);
+        max[1] = fmax(max[1], la->p[i][1]);
+        min[1] = fmin(min[1], la->p[i][1]);
+    }
+
+    int maxi[2], mini[2];
+    maxi[0] = (int)ceil(max[0]-0.5);
+    mini[0] = (int)ceil(min[0]-0.5);
+    maxi[1] = (int)ceil(max[1]-0.5);
+    mini[1] = (int)ceil(min[1]-0.5);
+
+    zarray_t *quad_poly = g2d_polygon_create_data(la->p, 4);
+
+    double p[2];
+    for (int ix = mini[0]; ix <= maxi[0]; ix++) {
+        for (int iy = mini[1]; iy <= maxi[1]; iy++) {
+            p[0] = (double)ix;
+            p[1] = (double)iy;
+            if (g2d_polygon_contains_point(quad_poly, p)) {
+                avg += value_for_pixel(im, ix, iy);
+                n++;
+            }
+        }
+    }
+
+    uint8_t res = 0;
+    if (n > 0) {
+        res = (uint8_t)(avg / n);
+    }
+
+    zarray_destroy(quad_poly);
+    return res;
+}
+
+static void bench_brightness(getopt_t *getopt)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    int ncandidates = getopt_get_int(getopt, "candidates");
+    int iters = getopt_get_int(getopt, "iters");
+    double size = getopt_get_double(getopt, "size");
+
+    image_u8_t *im = noise_image(width, height);
+    lightanchor_t *las = calloc(ncandidates, sizeof(lightanchor_t));
+    for (int i = 0; i < ncandidates; i++)
+        random_anchor(&las[i], size + randf()*(width - 2*size),
+                      size + randf()*(height - 2*size), size);
+
+    int max_diff = 0;
+    volatile uint32_t sink = 0;
+
+    int64_t t0 = utime_now();
+    for (int it = 0; it < iters; it++)
+        for (int i = 0; i < ncandidates; i++)
+            sink += extract_brightness_polygon(&las[i], im);
+    int64_t t1 = utime_now();
+    for (int it = 0; it < iters; it++)
+        for (int i = 0; i < ncandidates; i++)
+            sink += extract_brightness(&las[i], im);
+    int64_t t2 = utime_now();
+
+    for (int i = 0; i < ncandidates; i++)
+    {
+        int diff = abs((int)extract_brightness_polygon(&las[i], im) -
+                       (int)extract_brightness(&las[i], im));
+        if (diff > max_diff)
+            max_diff = diff;
+    }
+
+    double n = (double)iters * ncandidates;
+    printf("brightness: %dx%d image, %d candidates of size %.0f\n", width, height, ncandidates, size);
+    printf("  polygon  %10.3f us/candidate\n", (t1 - t0) / n);
+    printf("  scanline %10.3f us/candidate\n", (t2 - t1) / n);
+    printf("  max abs difference: %d gray levels\n", max_diff);
+
+    free(las);
+    image_u8_destroy(im);
+}
+
+/* per-frame cost of scanline sampling vs. integral image (including its build) */
+static void bench_integral(getopt_t *getopt)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    int iters = getopt_get_int(getopt, "iters");
+    double size = getopt_get_double(getopt, "size");
+
+    image_u8_t *im = noise_image(width, height);
+    integral_image_t *ii = integral_image_create();
+
+    printf("integral: %dx%d image, candidates of size %.0f\n", width, height, size);
+    printf("%12s %12s %14s %14s %10s\n", "candidates", "area frac", "scanline us", "integral us", "mismatch");
+
+    for (int ncandidates = 1; ncandidates <= 4096; ncandidates *= 2)
+    {
+        lightanchor_t *las = calloc(ncandidates, sizeof(lightanchor_t));
+        double area = 0;
+        for (int i = 0; i < ncandidates; i++)
+        {
+            random_anchor(&las[i], size + randf()*(width - 2*size),
+                          size + randf()*(height - 2*size), size);
+            area += lightanchor_area(&las[i]);
+        }
+
+        volatile uint32_t sink = 0;
+        int mismatch = 0;
+
+        int64_t t0 = utime_now();
+        for (int it = 0; it < iters; it++)
+            for (int i = 0; i < ncandidates; i++)
+                sink += extract_brightness(&las[i], im);
+        int64_t t1 = utime_now();
+        for (int it = 0; it < iters; it++)
+        {
+            integral_image_update(ii, im);
+            for (int i = 0; i < ncandidates; i++)
+                sink += extract_brightness_integral(&las[i], ii);
+        }
+        int64_t t2 = utime_now();
+
+        for (int i = 0; i < ncandidates; i++)
+            mismatch += extract_brightness(&las[i], im) != extract_brightness_integral(&las[i], ii);
+
+        printf("%12d %12.4f %14.2f %14.2f %10d\n", ncandidates, area / (width * height),
+               (double)(t1 - t0) / iters, (double)(t2 - t1) / iters, mismatch);
+        failures += mismatch;
+
+        free(las);
+    }
+
+    integral_image_destroy(ii);
+    image_u8_destroy(im);
+}
+
+/* closest new tag for every old tag, old O(n^2) loop vs. the spatial grid */
+static void bench_association(getopt_t *getopt)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    int iters = getopt_get_int(getopt, "iters");
+    double size = getopt_get_double(getopt, "size");
+    double thres_dist_center = 25.0, thres_dist_shape = 50.0;
+
+    spatial_grid_t *grid = spatial_grid_create();
+
+    printf("association: %dx%d frame, anchors of size %.0f\n", width, height, size);
+    printf("%12s %14s %14s %10s\n", "quads", "brute us", "grid us", "mismatch");
+
+    const int sizes[] = { 10, 20, 50, 100, 200, 500, 1000, 2000 };
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        int n = sizes[s];
+        lightanchor_t *old_tags = calloc(n, sizeof(lightanchor_t));
+        lightanchor_t *new_tags = calloc(n, sizeof(lightanchor_t));
+        int *brute = calloc(n, sizeof(int)), *grided = calloc(n, sizeof(int));
+        for (int i = 0; i < n; i++)
+        {
+            random_anchor(&old_tags[i], size + randf()*(width - 2*size),
+                          size + randf()*(height - 2*size), size);
+            random_anchor(&new_tags[i], old_tags[i].c[0] + 4*randf() - 2,
+                          old_tags[i].c[1] + 4*randf() - 2, size + randf());
+        }
+
+        int64_t t0 = utime_now();
+        for (int it = 0; it < iters; it++)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                lightanchor_t *old_tag = &old_tags[i];
+                double min_dist = MAX_DIST, min_dist_shape = MAX_DIST;
+                brute[i] = -1;
+                for (int j = 0; j < n; j++)
+                {
+                    lightanchor_t *new_tag = &new_tags[j];
+                    double dist = g2d_distance(old_tag->c, new_tag->c);
+                    double dist_shape_new = (g2d_distance(new_tag->p[0], new_tag->c) +
+                                             g2d_distance(new_tag->p[1], new_tag->c) +
+                                             g2d_distance(new_tag->p[2], new_tag->c) +
+                                             g2d_distance(new_tag->p[3], new_tag->c)) / 4;
+                    double dist_shape_old = (g2d_distance(old_tag->p[0], old_tag->c) +
+                                             g2d_distance(old_tag->p[1], old_tag->c) +
+                                             g2d_distance(old_tag->p[2], old_tag->c) +
+                                             g2d_distance(old_tag->p[3], old_tag->c)) / 4;
+                    double dist_shape = fabs(dist_shape_new - dist_shape_old);
+                    if ((dist < min_dist) && (dist_shape < min_dist_shape) &&
+                        (dist < thres_dist_center) && (dist_shape < thres_dist_shape))
+                    {
+                        min_dist = dist;
+                        min_dist_shape = dist_shape;
+                        brute[i] = j;
+                    }
+                }
+            }
+        }
+        int64_t t1 = utime_now();
+        for (int it = 0; it < iters; it++)
+        {
+            spatial_grid_reset(grid, thres_dist_center, n);
+            for (int j = 0; j < n; j++)
+                spatial_grid_add(grid, new_tags[j].c);
+
+            for (int i = 0; i < n; i++)
+            {
+                lightanchor_t *old_tag = &old_tags[i];
+                double min_dist = MAX_DIST, min_dist_shape = MAX_DIST;
+                grided[i] = -1;
+                zarray_t *neighbors = spatial_grid_query(grid, old_tag->c);
+                for (int k = 0; k < zarray_size(neighbors); k++)
+                {
+                    int j;
+                    zarray_get(neighbors, k, &j);
+                    lightanchor_t *new_tag = &new_tags[j];
+                    double dist = g2d_distance(old_tag->c, new_tag->c);
+                    double dist_shape = fabs(new_tag->shape - old_tag->shape);
+                    if ((dist < min_dist) && (dist_shape < min_dist_shape) &&
+                        (dist < thres_dist_center) && (dist_shape < thres_dist_shape))
+                    {
+                        min_dist = dist;
+                        min_dist_shape = dist_shape;
+                        grided[i] = j;
+                    }
+                }
+            }
+        }
+        int64_t t2 = utime_now();
+
+        int mismatch = 0;
+        for (int i = 0; i < n; i++)
+            mismatch += brute[i] != grided[i];
+
+        printf("%12d %14.2f %14.2f %10d\n", n,
+               (double)(t1 - t0) / iters, (double)(t2 - t1) / iters, mismatch);
+        failures += mismatch;
+
+        free(old_tags);
+        free(new_tags);
+        free(brute);
+        free(grided);
+    }
+
+    spatial_grid_destroy(grid);
+}
+
+/* optimal frame-to-frame assignment on a dense grid of jittered anchors */
+static void bench_assignment(getopt_t *getopt)
+{
+    int iters = getopt_get_int(getopt, "iters");
+    double thres_dist_center = 25.0, thres_dist_shape = 50.0;
+    double spacing = 20.0;
+
+    spatial_grid_t *grid = spatial_grid_create();
+    assignment_t *as = assignment_create();
+
+    printf("assignment: anchors %.0f px apart, thres_dist_center %.0f\n", spacing, thres_dist_center);
+    printf("%12s %12s %14s %12s\n", "anchors", "arcs", "solve us", "matched");
+
+    const int sizes[] = { 50, 100, 200, 500, 1000 };
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        int n = sizes[s];
+        int cols = (int)ceil(sqrt(n));
+        lightanchor_t *old_tags = calloc(n, sizeof(lightanchor_t));
+        lightanchor_t *new_tags = calloc(n, sizeof(lightanchor_t));
+        for (int i = 0; i < n; i++)
+        {
+            double cx = spacing * (1 + i % cols), cy = spacing * (1 + i / cols);
+            random_anchor(&old_tags[i], cx, cy, 10);
+            random_anchor(&new_tags[i], cx + 16*randf() - 8, cy + 16*randf() - 8, 10 + randf());
+        }
+
+        spatial_grid_reset(grid, thres_dist_center, n);
+        for (int j = 0; j < n; j++)
+            spatial_grid_add(grid, new_tags[j].c);
+
+        int matched = 0;
+        int64_t elapsed = 0;
+        for (int it = 0; it < iters; it++)
+        {
+            assignment_reset(as, n);
+            for (int i = 0; i < n; i++)
+            {
+                assignment_add_row(as);
+                zarray_t *neighbors = spatial_grid_query(grid, old_tags[i].c);
+                for (int k = 0; k < zarray_size(neighbors); k++)
+                {
+                    int j;
+                    zarray_get(neighbors, k, &j);
+                    double dist = g2d_distance(old_tags[i].c, new_tags[j].c);
+                    double dist_shape = fabs(old_tags[i].shape - new_tags[j].shape);
+                    if (dist < thres_dist_center && dist_shape < thres_dist_shape)
+                        assignment_add_arc(as, j, dist / thres_dist_center + dist_shape / thres_dist_shape);
+                }
+            }
+
+            int64_t t0 = utime_now();
+            matched = assignment_solve(as);
+            elapsed += utime_now() - t0;
+        }
+
+        printf("%12d %12d %14.2f %12d\n", n, zarray_size(as->arcs),
+               (double)elapsed / iters, matched);
+
+        free(old_tags);
+        free(new_tags);
+    }
+
+    assignment_destroy(as);
+    spatial_grid_destroy(grid);
+}
+
+/* detect_quads() copying every frame vs. a reused scratch image */
+static void bench_copy(getopt_t *getopt)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    int iters = getopt_get_int(getopt, "iters");
+
+    apriltag_detector_t *td = apriltag_detector_create();
+    td->quad_decimate = getopt_get_double(getopt, "decimate");
+    td->nthreads = getopt_get_int(getopt, "threads");
+
+    image_u8_t *im = noise_image(width, height);
+    image_u8_t *scratch = NULL;
+
+    int64_t copy_us = 0, scratch_us = 0;
+    int64_t copy_bytes = 0, scratch_bytes = 0;
+    for (int it = 0; it < iters; it++)
+    {
+        int64_t t0 = utime_now();
+        quads_destroy(detect_quads(td, im));
+        int64_t t1 = utime_now();
+
+        image_u8_t *prev = scratch;
+        quads_destroy(detect_quads_scratch(td, im, &scratch));
+        int64_t t2 = utime_now();
+
+        // detect_quads() allocates a copy every frame, the scratch only on resize
+        copy_bytes += (int64_t)im->stride * im->height;
+        if (scratch != prev)
+            scratch_bytes += (int64_t)scratch->stride * scratch->height;
+
+        copy_us += t1 - t0;
+        scratch_us += t2 - t1;
+    }
+
+    printf("copy: %dx%d frames, decimate %.1f\n", width, height, td->quad_decimate);
+    printf("  %-14s %12s %16s\n", "path", "us/frame", "bytes/frame");
+    printf("  %-14s %12.1f %16.0f\n", "detect_quads", (double)copy_us / iters, (double)copy_bytes / iters);
+    printf("  %-14s %12.1f %16.0f\n", "scratch", (double)scratch_us / iters, (double)scratch_bytes / iters);
+
+    image_u8_destroy(scratch);
+    image_u8_destroy(im);
+    apriltag_detector_destroy(td);
+}
+
+/* previous qb_stats(): rescans the whole window, 0 max / 255 min meant "unset" */
+static void qb_stats_rescan(const uint8_t *buf, int size, uint8_t *max, uint8_t *min, uint8_t *avg)
+{
+    int sum = 0;
+    *max = 0;
+    *min = 255;
+    for (int i = 0; i < size; i++)
+    {
+        *max = buf[i] > *max ? buf[i] : *max;
+        *min = buf[i] < *min ? buf[i] : *min;
+        sum += buf[i];
+    }
+    *max = (*max != 0) ? *max : 255;
+    *min = (*min != 255) ? *min : 0;
+    *avg = sum / size;
+}
+
+/* randomized check of the incremental window stats against a rescan, and their cost */
+static void bench_queue(getopt_t *getopt)
+{
+    int nsamples = getopt_get_int(getopt, "iters") * 1000;
+
+    // long runs of flat values, including black and white, with occasional jumps
+    uint8_t *samples = malloc(nsamples);
+    for (int i = 0; i < nsamples; i++)
+    {
+        samples[i] = (i == 0 || random() % 8 == 0) ? random() & 0xff : samples[i - 1];
+        if (random() % 64 == 0)
+            samples[i] = (random() & 1) ? 255 : 0;
+    }
+
+    printf("queue: %d samples per window size\n", nsamples);
+    printf("  %-6s %12s %12s %10s %10s\n", "window", "rescan ns", "qb ns", "mismatch", "sentinel");
+
+    for (int size = 1; size <= QB_MAX_SIZE; size *= 2)
+    {
+        uint8_t *window = calloc(size, 1);
+        struct queue_buf qb;
+        uint8_t max0, min0, avg0, max1, min1, avg1;
+        volatile uint32_t sink = 0;
+
+        int64_t t0 = utime_now();
+        for (int i = 0; i < nsamples; i++)
+        {
+            window[i % size] = samples[i];
+            qb_stats_rescan(window, size, &max0, &min0, &avg0);
+            sink += max0 + min0 + avg0;
+        }
+        int64_t t1 = utime_now();
+        qb_init(&qb, size);
+        for (int i = 0; i < nsamples; i++)
+        {
+            qb_add(&qb, samples[i]);
+            qb_stats(&qb, &max1, &min1, &avg1);
+            sink += max1 + min1 + avg1;
+        }
+        int64_t t2 = utime_now();
+
+        int mismatch = 0, sentinel = 0;
+        memset(window, 0, size);
+        qb_init(&qb, size);
+        for (int i = 0; i < nsamples; i++)
+        {
+            window[i % size] = samples[i];
+            qb_stats_rescan(window, size, &max0, &min0, &avg0);
+            qb_add(&qb, samples[i]);
+            qb_stats(&qb, &max1, &min1, &avg1);
+
+            if (!qb_full(&qb))
+                continue;
+
+            // the rescan cannot tell an all-black or all-white window from an empty one
+            if ((max0 != max1 && max1 == 0) || (min0 != min1 && min1 == 255))
+            {
+                sentinel++;
+                continue;
+            }
+            mismatch += max0 != max1 || min0 != min1 || avg0 != avg1;
+        }
+
+        printf("  %-6d %12.1f %12.1f %10d %10d\n", size,
+               1000.0 * (t1 - t0) / nsamples, 1000.0 * (t2 - t1) / nsamples, mismatch, sentinel);
+        failures += mismatch;
+        free(window);
+    }
+
+    free(samples);
+}
+
+static uint64_t random_word(int size)
+{
+    uint64_t word = ((uint64_t)random() << 42) ^ ((uint64_t)random() << 21) ^ random();
+    return size >= 64 ? word : word & ((1ULL << size) - 1);
+}
+
+/* reference acquisition: first code whose even or odd phase matches some rotation exactly */
+static int match_linear(lightanchor_detector_t *ld, uint64_t observed)
+{
+    for (int i = 0; i < zarray_size(ld->codes); i++)
+    {
+        glitter_code_t *code;
+        zarray_get_volatile(ld->codes, i, &code);
+        for (int r = 0; r < ld->code_width; r++)
+        {
+            uint64_t doubled = double_bits(rotl_bits(code->code, r, ld->code_width));
+            if ((observed & 0xaaaaaaaaaaaaaaaaULL) == (doubled & 0xaaaaaaaaaaaaaaaaULL) ||
+                (observed & 0x5555555555555555ULL) == (doubled & 0x5555555555555555ULL))
+                return i;
+        }
+    }
+    return -1;
+}
+
+/* registers up to n random codes that are not rotations of each other */
+static int add_random_codes(lightanchor_detector_t *ld, int n)
+{
+    int added = 0;
+    for (int tries = 0; added < n && tries < 64*n + 4096; tries++)
+        added += lightanchor_detector_add_code(ld, (uint32_t)random_word(ld->code_width)) == 0;
+    return added;
+}
+
+/* the observed word after frame f of a code's blink sequence, each bit shown for two frames */
+static uint64_t shift_in(uint64_t word, glitter_code_t *code, int width, int f)
+{
+    int size = 2*width;
+    return (word << 1) | ((code->doubled_code >> (size - 1 - f % size)) & 1);
+}
+
+/* acquisition cost of a linear scan vs. the code matcher, and how many more words match with bit errors */
+static void bench_match(getopt_t *getopt)
+{
+    int nwords = getopt_get_int(getopt, "iters") * 1000;
+
+    lightanchor_detector_t *ld = lightanchor_detector_create();
+    if (lightanchor_detector_set_code_width(ld, getopt_get_int(getopt, "bits")))
+    {
+        printf("Unsupported code width.\n");
+        exit(-1);
+    }
+    int ncodes = add_random_codes(ld, getopt_get_int(getopt, "candidates"));
+
+    uint64_t *words = malloc(nwords * sizeof(uint64_t));
+    for (int i = 0; i < nwords; i++)
+        words[i] = random_word(2*ld->code_width);
+
+    volatile int sink = 0;
+    int64_t t0 = utime_now();
+    for (int i = 0; i < nwords; i++)
+        sink += match_linear(ld, words[i]);
+    int64_t t1 = utime_now();
+
+    lightanchor_t la;
+    memset(&la, 0, sizeof(lightanchor_t));
+    for (int i = 0; i < nwords; i++)
+    {
+        la.valid = 0;
+        la.code = words[i];
+        sink += decode(ld, &la);
+    }
+    int64_t t2 = utime_now();
+
+    int mismatch = 0;
+    for (int i = 0; i < nwords; i++)
+    {
+        memset(&la, 0, sizeof(lightanchor_t));
+        la.code = words[i];
+        int valid = decode(ld, &la);
+
+        int idx = match_linear(ld, words[i]);
+        glitter_code_t *code = NULL;
+        if (idx >= 0)
+            zarray_get_volatile(ld->codes, idx, &code);
+        mismatch += valid != (idx >= 0) || (valid && la.match_code != code->code);
+    }
+
+    printf("match: %d codes of %d bits, %d random words\n", ncodes, ld->code_width, nwords);
+    printf("  linear  %10.1f ns/word\n", 1000.0 * (t1 - t0) / nwords);
+    printf("  matcher %10.1f ns/word\n", 1000.0 * (t2 - t1) / nwords);
+    printf("  mismatches with max_hamming 0: %d\n", mismatch);
+    failures += mismatch;
+
+    for (int h = 0; h <= 2; h++)
+    {
+        ld->max_hamming = h;
+        int matched = 0;
+        for (int i = 0; i < nwords; i++)
+        {
+            memset(&la, 0, sizeof(lightanchor_t));
+            la.code = words[i];
+            matched += decode(ld, &la);
+        }
+        printf("  max_hamming %d: %5.1f%% of words acquire a code\n", h, 100.0 * matched / nwords);
+    }
+
+    free(words);
+    lightanchor_detector_destroy(ld);
+}
+
+/*
+ * Every phase of every code: a candidate that has seen one full window of the
+ * blink sequence, starting anywhere in it, must acquire on that frame and keep
+ * tracking for the following periods.
+ */
+static void bench_phases(getopt_t *getopt)
+{
+    lightanchor_detector_t *ld = lightanchor_detector_create();
+    if (lightanchor_detector_set_code_width(ld, getopt_get_int(getopt, "bits")))
+    {
+        printf("Unsupported code width.\n");
+        exit(-1);
+    }
+    int ncodes = add_random_codes(ld, getopt_get_int(getopt, "candidates"));
+    int size = 2*ld->code_width;
+
+    int failed = 0, lost = 0, early = 0, slow = 0;
+    for (int i = 0; i < ncodes; i++)
+    {
+        glitter_code_t *code, *other;
+        zarray_get_volatile(ld->codes, i, &code);
+        zarray_get_volatile(ld->codes, (i + 1) % ncodes, &other);
+
+        for (int phase = 0; phase < size; phase++)
+        {
+            lightanchor_t la;
+            memset(&la, 0, sizeof(lightanchor_t));
+
+            for (int f = phase; f < phase + size; f++)
+                la.code = shift_in(la.code, code, ld->code_width, f);
+
+            if (!decode(ld, &la) || la.match_code != code->code)
+            {
+                failed++;
+                continue;
+            }
+
+            for (int f = phase + size; f < phase + 5*size; f++)
+            {
+                la.code = shift_in(la.code, code, ld->code_width, f);
+                if (!decode(ld, &la) || la.match_code != code->code)
+                {
+                    lost++;
+                    break;
+                }
+            }
+
+            // the same window sampled one frame at a time by a new candidate,
+            // which must not report anything before it is complete
+            memset(&la, 0, sizeof(lightanchor_t));
+            for (int f = phase; f < phase + size; f++)
+            {
+                int bit = (code->doubled_code >> (size - 1 - f % size)) & 1;
+                int decoded = decode_sample(ld, bit, &la.code, &la.next_code, &la.match_code,
+                                            &la.valid, &la.nbits);
+                if (f < phase + size - 1)
+                    early += decoded >= 0;
+                else if (decoded != 1 || la.match_code != code->code)
+                    failed++;
+            }
+
+            // when the anchor starts showing another code the track is lost; every
+            // sample after that must be looked up again right away, so the new code
+            // is picked up no later than the sample that completes a window of it
+            int f = 0, decoded = 0;
+            for (; f < size; f++)
+            {
+                int bit = (other->doubled_code >> (size - 1 - f)) & 1;
+                decoded = decode_sample(ld, bit, &la.code, &la.next_code, &la.match_code,
+                                        &la.valid, &la.nbits);
+                if (decoded < 0 || (decoded > 0 && la.match_code == other->code))
+                    break;
+            }
+            slow += f == size || decoded < 0;
+        }
+    }
+
+    printf("phases: %d codes of %d bits x %d phases\n", ncodes, ld->code_width, size);
+    printf("  not acquired after one window: %d\n", failed);
+    printf("  lost while tracking: %d\n", lost);
+    printf("  reported before a full window: %d\n", early);
+    printf("  another code not picked up within a window: %d\n", slow);
+    failures += failed + lost + early + slow;
+
+    lightanchor_detector_destroy(ld);
+}
+
+/* setup, acquisition and tracking cost of every supported code width */
+static void bench_widths(getopt_t *getopt)
+{
+    int ncodes = getopt_get_int(getopt, "candidates");
+    int nwords = getopt_get_int(getopt, "iters") * 1000;
+    int widths[] = { 8, 12, 16, 24, 32 };
+
+    printf("widths: up to %d codes, %d words\n", ncodes, nwords);
+    printf("  %-6s %8s %12s %14s %14s %14s\n", "width", "codes", "setup us", "acquire ns", "acquire h1 ns", "track ns");
+
+    for (int w = 0; w < (int)(sizeof(widths) / sizeof(widths[0])); w++)
+    {
+        lightanchor_detector_t *ld = lightanchor_detector_create();
+        lightanchor_detector_set_code_width(ld, widths[w]);
+        int size = 2*widths[w];
+
+        int64_t t0 = utime_now();
+        int added = add_random_codes(ld, ncodes);
+        int64_t t1 = utime_now();
+
+        uint64_t *words = malloc(nwords * sizeof(uint64_t));
+        for (int i = 0; i < nwords; i++)
+            words[i] = random_word(size);
+
+        volatile int sink = 0;
+        lightanchor_t la;
+        memset(&la, 0, sizeof(lightanchor_t));
+
+        double acquire_ns[2];
+        for (int h = 0; h <= 1; h++)
+        {
+            ld->max_hamming = h;
+            int64_t t2 = utime_now();
+            for (int i = 0; i < nwords; i++)
+            {
+                la.valid = 0;
+                la.code = words[i];
+                sink += decode(ld, &la);
+            }
+            acquire_ns[h] = 1000.0 * (utime_now() - t2) / nwords;
+        }
+        ld->max_hamming = 0;
+
+        // follow one code, after acquisition every frame takes the tracking path
+        glitter_code_t *code;
+        zarray_get_volatile(ld->codes, 0, &code);
+        memset(&la, 0, sizeof(lightanchor_t));
+        for (int f = 0; f < size; f++)
+            la.code = shift_in(la.code, code, widths[w], f);
+        decode(ld, &la);
+
+        int64_t t3 = utime_now();
+        for (int f = size; f < size + nwords; f++)
+        {
+            la.code = shift_in(la.code, code, widths[w], f);
+            sink += decode(ld, &la);
+        }
+        double track_ns = 1000.0 * (utime_now() - t3) / nwords;
+
+        printf("  %-6d %8d %12.1f %14.1f %14.1f %14.1f\n", widths[w], added,
+               (double)(t1 - t0), acquire_ns[0], acquire_ns[1], track_ns);
+
+        free(words);
+        lightanchor_detector_destroy(ld);
+    }
+}
+
+/*
+ * One frame's acquisition words, each a registered code at a random phase with one
+ * flipped sample, matched with max_hamming 1: hamming_scan() against its plain C
+ * version, and match_codes() over the whole batch, checked against the per-word scan.
+ */
+static void bench_batch(getopt_t *getopt)
+{
+    int ncodes = getopt_get_int(getopt, "candidates");
+    int iters = getopt_get_int(getopt, "iters");
+    int nwords = 500;
+
+    printf("batch: %s, up to %d codes, %d words per frame\n", hamming_scan_isa(), ncodes, nwords);
+    printf("  %-6s %8s %14s %14s %14s %10s\n", "width", "codes", "scalar ns", "simd ns", "batch ns", "mismatch");
+
+    for (int width = 16; width <= CODE_WIDTH_MAX; width += 8)
+    {
+        lightanchor_detector_t *ld = lightanchor_detector_create();
+        lightanchor_detector_set_code_width(ld, width);
+        ld->max_hamming = 1;
+        int added = add_random_codes(ld, ncodes);
+        int size = 2*width;
+
+        uint64_t *words = malloc(nwords * sizeof(uint64_t));
+        for (int i = 0; i < nwords; i++)
+        {
+            glitter_code_t *code;
+            zarray_get_volatile(ld->codes, random() % added, &code);
+            uint64_t word = 0;
+            int phase = random() % size;
+            for (int f = phase; f < phase + size; f++)
+                word = shift_in(word, code, width, f);
+            words[i] = word ^ (1ULL << (random() % size));
+        }
+
+        const uint32_t *table = (const uint32_t *)ld->code_rotations->data;
+        int ntable = zarray_size(ld->code_rotations);
+        uint32_t mask = (uint32_t)((1ULL << width) - 1);
+
+        int mismatch = 0;
+        volatile int sink = 0;
+        int64_t scalar_us = 0, simd_us = 0;
+        for (int it = 0; it < iters; it++)
+        {
+            int64_t t0 = utime_now();
+            for (int i = 0; i < nwords; i++)
+            {
+                int dist;
+                sink += hamming_scan_scalar(table, ntable, undouble_bits(words[i] >> 1) & mask,
+                                            undouble_bits(words[i]) & mask, &dist);
+            }
+            int64_t t1 = utime_now();
+            for (int i = 0; i < nwords; i++)
+            {
+                int dist;
+                sink += hamming_scan(table, ntable, undouble_bits(words[i] >> 1) & mask,
+                                     undouble_bits(words[i]) & mask, &dist);
+            }
+            int64_t t2 = utime_now();
+            scalar_us += t1 - t0;
+            simd_us += t2 - t1;
+        }
+
+        for (int i = 0; i < nwords; i++)
+        {
+            int d0, d1;
+            uint32_t even = undouble_bits(words[i] >> 1) & mask, odd = undouble_bits(words[i]) & mask;
+            mismatch += hamming_scan_scalar(table, ntable, even, odd, &d0) !=
+                        hamming_scan(table, ntable, even, odd, &d1) || d0 != d1;
+        }
+
+        int32_t *idx = malloc(nwords * sizeof(int32_t));
+        uint8_t *rot = malloc(nwords);
+        int64_t t3 = utime_now();
+        for (int it = 0; it < iters; it++)
+            match_codes(ld, words, nwords, idx, rot);
+        int64_t batch_us = utime_now() - t3;
+
+        // the batch picks its matcher once, so check it against the per-word scan
+        for (int i = 0; i < nwords; i++)
+        {
+            int dist;
+            int k = hamming_scan_scalar(table, ntable, undouble_bits(words[i] >> 1) & mask,
+                                        undouble_bits(words[i]) & mask, &dist);
+            int want = (k < 0 || dist > ld->max_hamming) ? -1 : k / width;
+            mismatch += idx[i] != want || (want >= 0 && rot[i] != k % width);
+        }
+
+        double n = (double)iters * nwords;
+        printf("  %-6d %8d %14.1f %14.1f %14.1f %10d\n", width, added,
+               1000.0 * scalar_us / n, 1000.0 * simd_us / n, 1000.0 * batch_us / n, mismatch);
+        failures += mismatch;
+
+        free(idx);
+        free(rot);
+        free(words);
+        lightanchor_detector_destroy(ld);
+    }
+}
+
+/* decode_tags() with edge refinement, from 1 up to --threads workers */
+static void bench_refine(getopt_t *getopt)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    int iters = getopt_get_int(getopt, "iters");
+    int n = getopt_get_int(getopt, "candidates");
+    int size = (int)getopt_get_double(getopt, "size");
+    int max_threads = getopt_get_int(getopt, "threads");
+
+    // dark squares on a bright background, detected corners off by up to a pixel
+    image_u8_t *im = image_u8_create(width, height);
+    memset(im->buf, 200, im->stride * height);
+
+    zarray_t *quads = zarray_create(sizeof(struct quad));
+    for (int i = 0; i < n; i++)
+    {
+        int x0 = random() % (width - size), y0 = random() % (height - size);
+        for (int y = y0; y < y0 + size; y++)
+            memset(&im->buf[y*im->stride + x0], 30, size);
+
+        struct quad quad;
+        memset(&quad, 0, sizeof(struct quad));
+        double corners[4][2] = { { x0, y0 + size }, { x0 + size, y0 + size }, { x0 + size, y0 }, { x0, y0 } };
+        for (int j = 0; j < 4; j++)
+        {
+            quad.p[j][0] = corners[j][0] + randf() * 2 - 1;
+            quad.p[j][1] = corners[j][1] + randf() * 2 - 1;
+        }
+        zarray_add(quads, &quad);
+    }
+
+    printf("refine: %d quads of %dpx in a %dx%d frame\n", n, size, width, height);
+    printf("  %-8s %12s %10s\n", "threads", "us/frame", "speedup");
+
+    double base = 0;
+    for (int nthreads = 1; nthreads <= max_threads; nthreads++)
+    {
+        apriltag_detector_t *td = apriltag_detector_create();
+        td->nthreads = nthreads;
+        td->refine_edges = 1;
+        lightanchor_detector_t *ld = lightanchor_detector_create();
+
+        int64_t us = 0;
+        for (int it = 0; it < iters; it++)
+        {
+            // decode_tags() consumes the quads
+            zarray_t *frame_quads = zarray_copy(quads);
+
+            int64_t t0 = utime_now();
+            decode_tags(td, ld, frame_quads, im);
+            us += utime_now() - t0;
+        }
+
+        double per_frame = (double)us / iters;
+        if (nthreads == 1)
+            base = per_frame;
+        printf("  %-8d %12.1f %10.2f\n", nthreads, per_frame, base / per_frame);
+
+        lightanchor_detector_destroy(ld);
+        apriltag_detector_destroy(td);
+    }
+
+    zarray_destroy(quads);
+    image_u8_destroy(im);
+}
+
+/* one frame's worth of hot-field work: distance to a point, shape and ttl checks, next code bit */
+static double layout_pass_aos(lightanchor_t **las, int n, const double q[2], int f)
+{
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        lightanchor_t *la = las[i];
+        double dx = la->c[0] - q[0], dy = la->c[1] - q[1];
+        sum += dx*dx + dy*dy + la->shape + la->frames;
+        la->code = (la->code << 1) | ((i ^ f) & 1);
+    }
+    return sum;
+}
+
+static double layout_pass_soa(candidate_table_t *t, const double q[2], int f)
+{
+    double sum = 0;
+    for (int i = 0; i < t->size; i++)
+    {
+        double dx = t->c[i][0] - q[0], dy = t->c[i][1] - q[1];
+        sum += dx*dx + dy*dy + t->shape[i] + t->frames[i];
+        t->code[i] = (t->code[i] << 1) | ((i ^ f) & 1);
+    }
+    return sum;
+}
+
+/*
+ * Candidates as individually allocated lightanchor_t behind a pointer array (visited in
+ * allocation order shuffled, as after some frames of churn) vs. a candidate_table_t.
+ * Hardware counters are not portable, so cache behaviour shows up as throughput across
+ * candidate counts whose working set goes from L1 to well past the last-level cache.
+ */
+static void bench_layout(getopt_t *getopt)
+{
+    int iters = getopt_get_int(getopt, "iters");
+    int sizes[] = { 256, 4096, 32768, 131072 };
+
+    printf("layout: hot pass over candidates, lightanchor_t is %d bytes\n", (int)sizeof(lightanchor_t));
+    printf("  %10s %14s %14s %10s\n", "candidates", "aos ns/cand", "soa ns/cand", "speedup");
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        int n = sizes[s];
+        lightanchor_t **las = malloc(n * sizeof(lightanchor_t *));
+        candidate_table_t *t = candidate_table_create();
+
+        for (int i = 0; i < n; i++)
+        {
+            las[i] = malloc(sizeof(lightanchor_t));
+            random_anchor(las[i], randf() * 1280, randf() * 720, 10 + 20*randf());
+            las[i]->frames = random() % 8;
+        }
+        for (int i = n - 1; i > 0; i--)
+        {
+            int j = random() % (i + 1);
+            lightanchor_t *tmp = las[i];
+            las[i] = las[j];
+            las[j] = tmp;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            int row = candidate_table_add(t);
+            t->c[row][0] = las[i]->c[0];
+            t->c[row][1] = las[i]->c[1];
+            t->shape[row] = las[i]->shape;
+            t->frames[row] = las[i]->frames;
+            memcpy(t->p[row], las[i]->p, sizeof(las[i]->p));
+        }
+
+        // same amount of work per size
+        int passes = imax(1, (int)((int64_t)iters * 65536 / n));
+        double q[2] = { 640, 360 };
+        double aos_sum = 0, soa_sum = 0;
+
+        int64_t t0 = utime_now();
+        for (int f = 0; f < passes; f++)
+            aos_sum += layout_pass_aos(las, n, q, f);
+        int64_t t1 = utime_now();
+        for (int f = 0; f < passes; f++)
+            soa_sum += layout_pass_soa(t, q, f);
+        int64_t t2 = utime_now();
+
+        int mismatches = (aos_sum != soa_sum);
+        for (int i = 0; i < n; i++)
+            mismatches += (las[i]->code != t->code[i]);
+
+        double aos_ns = 1000.0 * (t1 - t0) / ((double)passes * n);
+        double soa_ns = 1000.0 * (t2 - t1) / ((double)passes * n);
+        printf("  %10d %14.2f %14.2f %9.1fx%s\n", n, aos_ns, soa_ns, aos_ns / soa_ns,
+               mismatches ? "  MISMATCH" : "");
+        failures += mismatches;
+
+        for (int i = 0; i < n; i++)
+            free(las[i]);
+        free(las);
+        candidate_table_destroy(t);
+    }
+}
+
+/*
+ * decode_tags() on squares blinking registered codes, some of them dropping out, then
+ * packing the frame into a result ring vs. copying it out with
+ * lightanchor_detector_get_detections(). Both must report the same detections.
+ */
+static void bench_ring(getopt_t *getopt)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    int frames = getopt_get_int(getopt, "iters");
+    int n = getopt_get_int(getopt, "candidates");
+    double size = getopt_get_double(getopt, "size");
+
+    apriltag_detector_t *td = apriltag_detector_create();
+    td->nthreads = getopt_get_int(getopt, "threads");
+    td->refine_edges = 0;
+
+    lightanchor_detector_t *ld = lightanchor_detector_create();
+    ld->range_thres = 20;
+    ld->ttl_frames = 8;
+    ld->thres_dist_shape = 50;
+    ld->thres_dist_shape_ttl = 20;
+    ld->thres_dist_center = 25;
+    int ncodes = add_random_codes(ld, 4);
+
+    double (*pos)[2] = malloc(n * sizeof(double[2]));
+    int *code = malloc(n * sizeof(int)), *phase = malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+        pos[i][0] = size + randf() * (width - 2*size);
+        pos[i][1] = size + randf() * (height - 2*size);
+        code[i] = random() % ncodes;
+        phase[i] = random() % (2*ld->code_width);
+    }
+
+    image_u8_t *im = image_u8_create(width, height);
+    result_ring_t *ring = result_ring_create(4, 2*n);
+    lightanchor_detection_t *dets = malloc(n * sizeof(lightanchor_detection_t));
+
+    int64_t ring_us = 0, copy_us = 0;
+    int ndetections = 0, nlost = 0, mismatches = 0;
+    for (int f = 0; f < frames; f++)
+    {
+        memset(im->buf, 10, im->stride * im->height);
+        zarray_t *quads = zarray_create(sizeof(struct quad));
+        for (int i = 0; i < n; i++)
+        {
+            glitter_code_t *c;
+            zarray_get_volatile(ld->codes, code[i], &c);
+            int t = (f + phase[i]) / 2 % ld->code_width;
+            int bit = (c->code >> (ld->code_width - 1 - t)) & 1;
+
+            int x0 = pos[i][0] - size/2, y0 = pos[i][1] - size/2;
+            for (int y = imax(0, y0); y < imin(height, y0 + size); y++)
+                memset(&im->buf[y*im->stride + imax(0, x0)], bit ? 250 : 60,
+                       imin(width, x0 + size) - imax(0, x0));
+
+            // missed now and then, long enough runs of misses end the track
+            if (random() % 20 == 0)
+                continue;
+
+            struct quad quad;
+            memset(&quad, 0, sizeof(struct quad));
+            quad.p[0][0] = x0;          quad.p[0][1] = y0 + size;
+            quad.p[1][0] = x0 + size;   quad.p[1][1] = y0 + size;
+            quad.p[2][0] = x0 + size;   quad.p[2][1] = y0;
+            quad.p[3][0] = x0;          quad.p[3][1] = y0;
+            zarray_add(quads, &quad);
+        }
+
+        decode_tags(td, ld, quads, im);
+
+        int64_t t0 = utime_now();
+        int32_t *slot = result_ring_write(ring, lightanchor_detector_events(ld), 1);
+        int64_t t1 = utime_now();
+        int ndets = lightanchor_detector_get_detections(ld, dets, n);
+        int64_t t2 = utime_now();
+
+        ring_us += t1 - t0;
+        copy_us += t2 - t1;
+        ndetections += ndets;
+        nlost += slot[RESULT_NLOST];
+
+        int32_t *ints = result_ring_ints(ring, slot);
+        double *doubles = result_ring_doubles(ring, slot);
+        mismatches += slot[RESULT_NDETECTIONS] != ndets || slot[RESULT_NDROPPED] != 0;
+        for (int i = 0; i < imin(ndets, slot[RESULT_NDETECTIONS]); i++)
+        {
+            int32_t *rec = &ints[i * RESULT_INTS];
+            double *p = &doubles[i * RESULT_DOUBLES];
+            mismatches += (uint32_t)rec[RESULT_ID] != dets[i].id ||
+                          (uint32_t)rec[RESULT_CODE] != dets[i].match_code ||
+                          rec[RESULT_STATE] != dets[i].state ||
+                          p[RESULT_CX] != dets[i].c[0] || p[RESULT_CY] != dets[i].c[1] ||
+                          memcmp(&p[RESULT_P], dets[i].p, sizeof(dets[i].p)) != 0;
+        }
+        for (int i = slot[RESULT_NDETECTIONS]; i < slot[RESULT_NDETECTIONS] + slot[RESULT_NLOST]; i++)
+            mismatches += ints[i * RESULT_INTS + RESULT_STATE] != LIGHTANCHOR_LOST;
+    }
+
+    printf("ring: %d anchors, %d frames, %.1f detections and %.2f lost tracks per frame\n",
+           n, frames, (double)ndetections / frames, (double)nlost / frames);
+    printf("  %-22s %12.2f us/frame\n", "result_ring_write", (double)ring_us / frames);
+    printf("  %-22s %12.2f us/frame\n", "get_detections", (double)copy_us / frames);
+    printf("  mismatches: %d\n", mismatches);
+    failures += mismatches;
+
+    free(dets);
+    result_ring_destroy(ring);
+    image_u8_destroy(im);
+    free(pos);
+    free(code);
+    free(phase);
+    lightanchor_detector_destroy(ld);
+    apriltag_detector_destroy(td);
+}
+
+/* previous save_grayscale(), then every decimate-th pixel of its output */
+static void gray_two_pass(const uint8_t *rgba, int width, int height, int decimate,
+                          uint8_t *full, image_u8_t *out)
+{
+    const int len = width * height * 4;
+    for (int i = 0, j = 0; i < len; i+=4, j++)
+        full[j] = rgba[i];
+
+    for (int y = 0, sy = 0; y < height; y += decimate, sy++)
+        for (int x = 0, sx = 0; x < width; x += decimate, sx++)
+            out->buf[sy*out->stride + sx] = full[y*width + x];
+}
+
+/* RGBA to gray, fused and SIMD against the two passes it replaces */
+static void bench_gray(getopt_t *getopt)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    int iters = getopt_get_int(getopt, "iters");
+
+    uint8_t *rgba = malloc(width * height * 4);
+    for (int i = 0; i < width * height * 4; i++)
+        rgba[i] = random() & 0xff;
+    uint8_t *full = malloc(width * height);
+
+    printf("gray: %s, %dx%d RGBA\n", gray_convert_isa(), width, height);
+    printf("  %-5s %-8s %12s %12s %12s %10s\n", "mode", "decimate", "2-pass ms", "scalar ms", "simd ms", "mismatch");
+
+    for (int mode = GRAY_RED; mode <= GRAY_LUMA; mode++)
+    {
+        for (int decimate = 1; decimate <= 3; decimate++)
+        {
+            int w = gray_decimated_size(width, decimate), h = gray_decimated_size(height, decimate);
+            image_u8_t *ref = image_u8_create(w, h);
+            image_u8_t *out = image_u8_create(w, h);
+
+            int64_t two_pass_us = 0, scalar_us = 0, simd_us = 0;
+            for (int it = 0; it < iters; it++)
+            {
+                int64_t t0 = utime_now();
+                if (mode == GRAY_RED)
+                    gray_two_pass(rgba, width, height, decimate, full, ref);
+                int64_t t1 = utime_now();
+                gray_convert_scalar(rgba, width, height, width * 4, 4, mode, decimate, ref);
+                int64_t t2 = utime_now();
+                gray_convert(rgba, width, height, width * 4, 4, mode, decimate, out);
+                int64_t t3 = utime_now();
+                two_pass_us += t1 - t0;
+                scalar_us += t2 - t1;
+                simd_us += t3 - t2;
+            }
+
+            int mismatch = 0;
+            for (int y = 0; y < h; y++)
+                mismatch += memcmp(&ref->buf[y*ref->stride], &out->buf[y*out->stride], w) != 0;
+            if (mode == GRAY_RED)
+            {
+                gray_two_pass(rgba, width, height, decimate, full, ref);
+                for (int y = 0; y < h; y++)
+                    mismatch += memcmp(&ref->buf[y*ref->stride], &out->buf[y*out->stride], w) != 0;
+            }
+
+            char two_pass[32] = "-";
+            if (mode == GRAY_RED)
+                snprintf(two_pass, sizeof(two_pass), "%.3f", two_pass_us / 1000.0 / iters);
+            printf("  %-5s %-8d %12s %12.3f %12.3f %10d\n", mode == GRAY_RED ? "red" : "luma", decimate,
+                   two_pass, scalar_us / 1000.0 / iters, simd_us / 1000.0 / iters, mismatch);
+            failures += mismatch;
+
+            image_u8_destroy(ref);
+            image_u8_destroy(out);
+        }
+    }
+
+    // frames as other producers hand them over: padded rows, RGB or gray,
+    // checked pixel by pixel, and the time a copy into a staging buffer first adds
+    printf("  %-8s %-5s %-8s %12s %12s %10s\n", "channels", "mode", "decimate", "copied ms", "in place ms", "mismatch");
+    int channels[] = { 4, 3, 1 };
+    for (int c = 0; c < 3; c++)
+    {
+        int stride = width * channels[c] + 12;
+        uint8_t *src = malloc(stride * height);
+        uint8_t *staging = malloc(stride * height);
+        for (int i = 0; i < stride * height; i++)
+            src[i] = random() & 0xff;
+
+        for (int mode = GRAY_RED; mode <= GRAY_LUMA; mode++)
+        {
+            if (channels[c] == 1 && mode == GRAY_LUMA)
+                continue;
+
+            for (int decimate = 1; decimate <= 2; decimate++)
+            {
+                int w = gray_decimated_size(width, decimate), h = gray_decimated_size(height, decimate);
+                image_u8_t *out = image_u8_create(w, h);
+
+                int64_t copied_us = 0, in_place_us = 0;
+                for (int it = 0; it < iters; it++)
+                {
+                    int64_t t0 = utime_now();
+                    memcpy(staging, src, stride * height);
+                    gray_convert(staging, width, height, stride, channels[c], mode, decimate, out);
+                    int64_t t1 = utime_now();
+                    gray_convert(src, width, height, stride, channels[c], mode, decimate, out);
+                    int64_t t2 = utime_now();
+                    copied_us += t1 - t0;
+                    in_place_us += t2 - t1;
+                }
+
+                int mismatch = 0;
+                for (int y = 0; y < h; y++)
+                {
+                    for (int x = 0; x < w; x++)
+                    {
+                        const uint8_t *px = &src[y*decimate*stride + x*decimate*channels[c]];
+                        int v = px[0];
+                        if (channels[c] > 1 && mode == GRAY_LUMA)
+                            v = (77*px[0] + 150*px[1] + 29*px[2] + 128) >> 8;
+                        mismatch += out->buf[y*out->stride + x] != v;
+                    }
+                }
+
+                printf("  %-8d %-5s %-8d %12.3f %12.3f %10d\n", channels[c], mode == GRAY_RED ? "red" : "luma",
+                       decimate, copied_us / 1000.0 / iters, in_place_us / 1000.0 / iters, mismatch);
+                failures += mismatch;
+                image_u8_destroy(out);
+            }
+        }
+
+        free(staging);
+        free(src);
+    }
+
+    free(full);
+    free(rgba);
+}
+
+/*
+ * End-to-end suite: detect_quads_tracked() and decode_tags() over a sequence,
+ * for every combination of the sweep options. The sequence is a synth_sequence_t
+ * blinking codes from the code table, or the PNM frames given as extra arguments.
+ * Frames are decimated the way the web pipeline does it, before quad detection,
+ * with quad_decimate set to the same factor. Fractional factors, which the web
+ * pipeline gets from drawing into a smaller canvas, are resampled to the nearest
+ * pixel.
+ */
+#define SUITE_MAX_SWEEP         16
+#define SUITE_STAGES            4
+
+static const char *suite_stages[SUITE_STAGES] = { "decimate", "quads", "decode", "total" };
+
+struct suite_result
+{
+    int nthreads, refine, ncandidates, ncodes;
+    double decimate;
+    int frames;
+
+    // microseconds
+    double p50[SUITE_STAGES], p99[SUITE_STAGES];
+    double fps;
+
+    // per frame, allocations are the detector's own, see ld->nallocs
+    double allocs;
+    double quads;
+    double detections;
+};
+
+static int parse_sweep(getopt_t *getopt, const char *name, int *out)
+{
+    const char *s = getopt_get_string(getopt, name);
+    int n = 0;
+    while (n < SUITE_MAX_SWEEP)
+    {
+        char *end;
+        out[n++] = strtol(s, &end, 10);
+        if (*end != ',')
+            break;
+        s = end + 1;
+    }
+    return n;
+}
+
+static int parse_sweep_double(getopt_t *getopt, const char *name, double *out)
+{
+    const char *s = getopt_get_string(getopt, name);
+    int n = 0;
+    while (n < SUITE_MAX_SWEEP)
+    {
+        char *end;
+        out[n++] = strtod(s, &end);
+        if (*end != ',')
+            break;
+        s = end + 1;
+    }
+    return n;
+}
+
+/* size of a side after decimating by a factor that may be fractional */
+static int suite_decimated_size(int size, double decimate)
+{
+    if (decimate == (int)decimate)
+        return gray_decimated_size(size, (int)decimate);
+    return imax(1, (int)(size / decimate));
+}
+
+/* decimates a gray frame into out, through gray_convert() for integer factors */
+static void suite_decimate(image_u8_t *im, double decimate, image_u8_t *out)
+{
+    if (decimate == (int)decimate)
+    {
+        gray_convert(im->buf, im->width, im->height, im->stride, 1, GRAY_RED, (int)decimate, out);
+        return;
+    }
+
+    for (int y = 0; y < out->height; y++)
+    {
+        const uint8_t *row = &im->buf[(int)(y * decimate) * im->stride];
+        for (int x = 0; x < out->width; x++)
+            out->buf[y*out->stride + x] = row[(int)(x * decimate)];
+    }
+}
+
+static int compare_int64(const void *_a, const void *_b)
+{
+    int64_t a = *(const int64_t *)_a, b = *(const int64_t *)_b;
+    return (a > b) - (a < b);
+}
+
+/* nearest-rank percentile, sorts v */
+static double percentile(int64_t *v, int n, double q)
+{
+    qsort(v, n, sizeof(int64_t), compare_int64);
+    int i = (int)ceil(q * n) - 1;
+    return v[imax(0, imin(n - 1, i))];
+}
+
+static void suite_run(getopt_t *getopt, zarray_t *recorded, struct suite_result *res)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    int frames = getopt_get_int(getopt, "iters");
+    double size = getopt_get_double(getopt, "size");
+
+    apriltag_detector_t *td = apriltag_detector_create();
+    td->nthreads = res->nthreads;
+    td->refine_edges = res->refine;
+    td->quad_decimate = res->decimate;
+
+    lightanchor_detector_t *ld = lightanchor_detector_create();
+    lightanchor_detector_set_code_width(ld, getopt_get_int(getopt, "bits"));
+    ld->range_thres = 20;
+    ld->ttl_frames = 8;
+    ld->thres_dist_shape = 50;
+    ld->thres_dist_shape_ttl = 20;
+    ld->thres_dist_center = 25;
+    int ncodes = add_random_codes(ld, res->ncodes);
+
+    synth_sequence_t *seq = NULL;
+    image_u8_t *synth = NULL;
+    if (!recorded)
+    {
+        uint32_t *codes = malloc(ncodes * sizeof(uint32_t));
+        for (int i = 0; i < ncodes; i++)
+        {
+            glitter_code_t *c;
+            zarray_get_volatile(ld->codes, i, &c);
+            codes[i] = c->code;
+        }
+
+        synth_params_t params;
+        synth_params_init(&params);
+        params.width = width;
+        params.height = height;
+        params.nanchors = res->ncandidates;
+        params.size = size;
+        seq = synth_sequence_create(&params, codes, ncodes, ld->code_width);
+        synth = image_u8_create(width, height);
+        free(codes);
+    }
+    image_u8_t *decimated = NULL;
+
+    int64_t *us[SUITE_STAGES];
+    for (int k = 0; k < SUITE_STAGES; k++)
+        us[k] = calloc(frames, sizeof(int64_t));
+
+    uint64_t allocs = 0;
+    int64_t total_us = 0;
+    int nquads = 0, ndetections = 0;
+
+    // frame -1 sets up the worker pool and scratch buffers and is not measured
+    for (int f = -1; f < frames; f++)
+    {
+        image_u8_t *im;
+        if (recorded)
+        {
+            zarray_get(recorded, (f + 1) % zarray_size(recorded), &im);
+        }
+        else {
+            synth_sequence_render(seq, synth);
+            im = synth;
+        }
+
+        if (res->decimate > 1)
+        {
+            int w = suite_decimated_size(im->width, res->decimate);
+            int h = suite_decimated_size(im->height, res->decimate);
+            if (decimated == NULL || decimated->width != w || decimated->height != h)
+            {
+                image_u8_destroy(decimated);
+                decimated = image_u8_create(w, h);
+            }
+        }
+
+        uint64_t a0 = ld->nallocs;
+        int64_t t0 = utime_now();
+
+        if (res->decimate > 1)
+        {
+            suite_decimate(im, res->decimate, decimated);
+            im = decimated;
+        }
+        int64_t t1 = utime_now();
+
+        zarray_t *quads = detect_quads_tracked(td, ld, im);
+        int frame_quads = zarray_size(quads);
+        int64_t t2 = utime_now();
+
+        zarray_t *detections = decode_tags(td, ld, quads, im);
+        int64_t t3 = utime_now();
+        uint64_t a1 = ld->nallocs;
+
+        if (f < 0)
+            continue;
+
+        us[0][f] = t1 - t0;
+        us[1][f] = t2 - t1;
+        us[2][f] = t3 - t2;
+        us[3][f] = t3 - t0;
+        total_us += t3 - t0;
+        allocs += a1 - a0;
+        nquads += frame_quads;
+        ndetections += zarray_size(detections);
+    }
+
+    res->frames = frames;
+    for (int k = 0; k < SUITE_STAGES; k++)
+    {
+        res->p50[k] = percentile(us[k], frames, 0.50);
+        res->p99[k] = percentile(us[k], frames, 0.99);
+        free(us[k]);
+    }
+    res->fps = total_us > 0 ? 1e6 * frames / total_us : 0;
+    res->allocs = (double)allocs / frames;
+    res->quads = (double)nquads / frames;
+    res->detections = (double)ndetections / frames;
+
+    image_u8_destroy(decimated);
+    image_u8_destroy(synth);
+    synth_sequence_destroy(seq);
+    lightanchor_detector_destroy(ld);
+    apriltag_detector_destroy(td);
+}
+
+static void suite_print_text(FILE *out, struct suite_result *results, int nresults)
+{
+    fprintf(out, "  %3s %3s %3s %5s %5s %9s", "thr", "dec", "ref", "cand", "codes", "fps");
+    for (int k = 0; k < SUITE_STAGES; k++)
+        fprintf(out, " %17s", suite_stages[k]);
+    fprintf(out, " %8s %7s %7s\n", "allocs", "quads", "dets");
+
+    for (int i = 0; i < nresults; i++)
+    {
+        struct suite_result *r = &results[i];
+        fprintf(out, "  %3d %3g %3d %5d %5d %9.1f", r->nthreads, r->decimate, r->refine,
+                r->ncandidates, r->ncodes, r->fps);
+        for (int k = 0; k < SUITE_STAGES; k++)
+            fprintf(out, " %8.0f/%-8.0f", r->p50[k], r->p99[k]);
+        fprintf(out, " %8.1f %7.1f %7.1f\n", r->allocs, r->quads, r->detections);
+    }
+    fprintf(out, "  stage times are p50/p99 in us, allocs/quads/dets are per frame\n");
+}
+
+static void suite_print_csv(FILE *out, struct suite_result *results, int nresults)
+{
+    fprintf(out, "threads,decimate,refine_edges,candidates,codes,frames,fps");
+    for (int k = 0; k < SUITE_STAGES; k++)
+        fprintf(out, ",%s_p50_us,%s_p99_us", suite_stages[k], suite_stages[k]);
+    fprintf(out, ",allocs_per_frame,quads_per_frame,detections_per_frame\n");
+
+    for (int i = 0; i < nresults; i++)
+    {
+        struct suite_result *r = &results[i];
+        fprintf(out, "%d,%g,%d,%d,%d,%d,%.3f", r->nthreads, r->decimate, r->refine,
+                r->ncandidates, r->ncodes, r->frames, r->fps);
+        for (int k = 0; k < SUITE_STAGES; k++)
+            fprintf(out, ",%.0f,%.0f", r->p50[k], r->p99[k]);
+        fprintf(out, ",%.2f,%.2f,%.2f\n", r->allocs, r->quads, r->detections);
+    }
+}
+
+static void suite_print_json(FILE *out, getopt_t *getopt, const char *input,
+                             struct suite_result *results, int nresults)
+{
+    fprintf(out, "{\n  \"input\": \"%s\",\n  \"width\": %d,\n  \"height\": %d,\n", input,
+            getopt_get_int(getopt, "width"), getopt_get_int(getopt, "height"));
+    fprintf(out, "  \"code_width\": %d,\n  \"hamming_isa\": \"%s\",\n  \"gray_isa\": \"%s\",\n",
+            getopt_get_int(getopt, "bits"), hamming_scan_isa(), gray_convert_isa());
+    fprintf(out, "  \"results\": [\n");
+    for (int i = 0; i < nresults; i++)
+    {
+        struct suite_result *r = &results[i];
+        fprintf(out, "    {\"threads\": %d, \"decimate\": %g, \"refine_edges\": %d, "
+                "\"candidates\": %d, \"codes\": %d, \"frames\": %d, \"fps\": %.3f, \"stages\": {",
+                r->nthreads, r->decimate, r->refine, r->ncandidates, r->ncodes, r->frames, r->fps);
+        for (int k = 0; k < SUITE_STAGES; k++)
+            fprintf(out, "%s\"%s\": {\"p50_us\": %.0f, \"p99_us\": %.0f}", k ? ", " : "",
+                    suite_stages[k], r->p50[k], r->p99[k]);
+        fprintf(out, "}, \"allocs_per_frame\": %.2f, \"quads_per_frame\": %.2f, "
+                "\"detections_per_frame\": %.2f}%s\n",
+                r->allocs, r->quads, r->detections, i + 1 < nresults ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void bench_suite(getopt_t *getopt)
+{
+    int threads[SUITE_MAX_SWEEP], refines[SUITE_MAX_SWEEP];
+    int candidates[SUITE_MAX_SWEEP], codes[SUITE_MAX_SWEEP];
+    double decimates[SUITE_MAX_SWEEP];
+    int nthreads = parse_sweep(getopt, "sweep-threads", threads);
+    int ndecimates = parse_sweep_double(getopt, "sweep-decimate", decimates);
+    int nrefines = parse_sweep(getopt, "sweep-refine", refines);
+    int ncandidates = parse_sweep(getopt, "sweep-candidates", candidates);
+    int ncodes = parse_sweep(getopt, "sweep-codes", codes);
+
+    const zarray_t *inputs = getopt_get_extra_args(getopt);
+    zarray_t *recorded = NULL;
+    if (zarray_size(inputs) > 0)
+    {
+        recorded = zarray_create(sizeof(image_u8_t *));
+        for (int i = 0; i < zarray_size(inputs); i++)
+        {
+            char *path;
+            zarray_get(inputs, i, &path);
+            image_u8_t *im = image_u8_create_from_pnm(path);
+            if (im == NULL)
+            {
+                printf("Couldn't load %s\n", path);
+                exit(-1);
+            }
+            zarray_add(recorded, &im);
+        }
+        // the frames decide how many candidates there are
+        ncandidates = 1;
+        candidates[0] = 0;
+    }
+
+    const char *format = getopt_get_string(getopt, "format");
+    const char *path = getopt_get_string(getopt, "output");
+    FILE *out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+    if (out == NULL)
+    {
+        printf("Couldn't open %s\n", path);
+        exit(-1);
+    }
+
+    int nresults = nthreads * ndecimates * nrefines * ncandidates * ncodes;
+    struct suite_result *results = calloc(nresults, sizeof(struct suite_result));
+
+    int i = 0;
+    for (int a = 0; a < nthreads; a++)
+    for (int b = 0; b < ndecimates; b++)
+    for (int c = 0; c < nrefines; c++)
+    for (int d = 0; d < ncandidates; d++)
+    for (int e = 0; e < ncodes; e++)
+    {
+        struct suite_result *r = &results[i++];
+        r->nthreads = threads[a];
+        r->decimate = fmax(1, decimates[b]);
+        r->refine = refines[c];
+        r->ncandidates = candidates[d];
+        r->ncodes = codes[e];
+
+        // the same anchors for every configuration
+        srandom(0);
+        suite_run(getopt, recorded, r);
+    }
+
+    char input[64];
+    if (recorded)
+        snprintf(input, sizeof(input), "%d recorded frames", zarray_size(recorded));
+    else
+        snprintf(input, sizeof(input), "synthetic");
+
+    if (!strcmp(format, "csv"))
+    {
+        suite_print_csv(out, results, nresults);
+    }
+    else if (!strcmp(format, "json"))
+    {
+        suite_print_json(out, getopt, input, results, nresults);
+    }
+    else
+    {
+        fprintf(out, "suite: %s, %dx%d, %d frames per configuration, hamming %s, gray %s\n", input,
+                getopt_get_int(getopt, "width"), getopt_get_int(getopt, "height"),
+                getopt_get_int(getopt, "iters"), hamming_scan_isa(), gray_convert_isa());
+        suite_print_text(out, results, nresults);
+    }
+
+    if (out != stdout)
+        fclose(out);
+    free(results);
+
+    if (recorded)
+    {
+        for (int i = 0; i < zarray_size(recorded); i++)
+        {
+            image_u8_t *im;
+            zarray_get(recorded, i, &im);
+            image_u8_destroy(im);
+        }
+        zarray_destroy(recorded);
+    }
+}
+
+// anchors of bench_tracked(): A is tracked, B appears straddling A's region, C away from it
+#define TRACKED_ANCHORS 3
+
+// per-detector state of bench_tracked()
+struct tracked_run
+{
+    const char *name;
+    lightanchor_detector_t *ld;
+
+    // first frame each anchor was reported at, -1 until then
+    int first[TRACKED_ANCHORS];
+    // reports off their anchor's true center, frames a tracked A was missing from, A's losses
+    int bad, dropped, lost;
+};
+
+/* matches one frame's events to the anchors of bench_tracked() by code */
+static void tracked_check(struct tracked_run *run, synth_sequence_t *seq, int f)
+{
+    int seen_a = 0;
+    zarray_t *events = lightanchor_detector_events(run->ld);
+    for (int i = 0; i < zarray_size(events); i++)
+    {
+        lightanchor_event_t *ev;
+        zarray_get_volatile(events, i, &ev);
+
+        int k = 0;
+        while (k < TRACKED_ANCHORS && seq->anchors[k].code != ev->match_code)
+            k++;
+        if (ev->type == LIGHTANCHOR_LOST)
+        {
+            run->lost += k == 0;
+            continue;
+        }
+
+        // a quad clipped at a region border is off the true center by a quarter side
+        if (k == TRACKED_ANCHORS || g2d_distance(ev->c, seq->anchors[k].c) > 2)
+        {
+            run->bad++;
+            continue;
+        }
+
+        seen_a |= k == 0;
+        if (run->first[k] < 0)
+            run->first[k] = f;
+    }
+
+    run->dropped += run->first[0] >= 0 && !seen_a;
+}
+
+/*
+ * ROI tracking against full-frame detection on a still scene. Anchor A is
+ * tracked, then B appears straddling the right border of A's region and C
+ * appears away from it. ROI mode must keep A, must not report the clipped part
+ * of B, and must pick up B and C at most roi_full_every frames after the
+ * full-frame detector does; C only on a periodic full scan.
+ */
+static void bench_tracked(getopt_t *getopt)
+{
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    double size = getopt_get_double(getopt, "size");
+
+    // 8-bit codes that blink often enough to decode in one window
+    uint32_t codes[TRACKED_ANCHORS] = { 0xeb, 0xdc, 0xc4 };
+
+    struct tracked_run runs[2] = { { .name = "full" }, { .name = "roi" } };
+    for (int r = 0; r < 2; r++)
+    {
+        lightanchor_detector_t *ld = lightanchor_detector_create();
+        ld->range_thres = 20;
+        ld->ttl_frames = 8;
+        ld->thres_dist_shape = 50;
+        ld->thres_dist_shape_ttl = 20;
+        ld->thres_dist_center = 25;
+        ld->track_roi = r;
+        // B's left half is inside A's region and its right half outside
+        ld->roi_pad = (int)size;
+        for (int k = 0; k < TRACKED_ANCHORS; k++)
+        {
+            lightanchor_detector_add_code(ld, codes[k]);
+            runs[r].first[k] = -1;
+        }
+        runs[r].ld = ld;
+    }
+
+    synth_params_t params;
+    synth_params_init(&params);
+    params.width = width;
+    params.height = height;
+    params.nanchors = TRACKED_ANCHORS;
+    params.size = size;
+    synth_sequence_t *seq = synth_sequence_create(&params, codes, TRACKED_ANCHORS,
+                                                  runs[0].ld->code_width);
+
+    // axis-aligned and still, B and C off frame until they appear
+    double ax = width / 2.0 - size, ay = height / 2.0;
+    double x[TRACKED_ANCHORS] = { ax, ax + 1.5 * size, width / 4.0 };
+    for (int k = 0; k < TRACKED_ANCHORS; k++)
+    {
+        synth_anchor_t *a = &seq->anchors[k];
+        a->code = codes[k];
+        a->size = size;
+        a->theta = a->omega = 0;
+        a->v[0] = a->v[1] = 0;
+        a->c[0] = k == 0 ? x[k] : -10 * size;
+        a->c[1] = ay;
+    }
+
+    int code_width = runs[0].ld->code_width;
+    int full_every = runs[1].ld->roi_full_every;
+    int appear = 4 * code_width;
+    int frames = appear + 2 * full_every + 4 * code_width;
+
+    apriltag_detector_t *td = apriltag_detector_create();
+    td->nthreads = getopt_get_int(getopt, "threads");
+    td->refine_edges = 0;
+    image_u8_t *im = image_u8_create(width, height);
+
+    for (int f = 0; f < frames; f++)
+    {
+        if (f == appear)
+        {
+            for (int k = 1; k < TRACKED_ANCHORS; k++)
+                seq->anchors[k].c[0] = x[k];
+        }
+        synth_sequence_render(seq, im);
+
+        for (int r = 0; r < 2; r++)
+        {
+            zarray_t *quads = detect_quads_tracked(td, runs[r].ld, im);
+            decode_tags(td, runs[r].ld, quads, im);
+            tracked_check(&runs[r], seq, f);
+        }
+    }
+
+    printf("tracked: %dx%d, anchors of size %.0f, B and C appear at frame %d, full scan every %d frames\n",
+           width, height, size, appear, full_every);
+    printf("  %-6s %8s %8s %8s %8s %8s %8s\n", "mode", "A found", "B found", "C found", "bad", "dropped", "lost");
+    for (int r = 0; r < 2; r++)
+    {
+        struct tracked_run *run = &runs[r];
+        printf("  %-6s %8d %8d %8d %8d %8d %8d\n", run->name, run->first[0], run->first[1], run->first[2],
+               run->bad, run->dropped, run->lost);
+        failures += run->bad + run->dropped + run->lost > 0;
+    }
+
+    for (int k = 0; k < TRACKED_ANCHORS; k++)
+    {
+        int full = runs[0].first[k], roi = runs[1].first[k];
+        if (full < 0 || roi < 0 || roi - full > full_every)
+        {
+            printf("  %c found %s\n", 'A' + k, full < 0 ? "by neither mode" : "too late in ROI mode");
+            failures++;
+        }
+    }
+
+    image_u8_destroy(im);
+    synth_sequence_destroy(seq);
+    for (int r = 0; r < 2; r++)
+        lightanchor_detector_destroy(runs[r].ld);
+    apriltag_detector_destroy(td);
+}
+
+int main(int argc, char *argv[])
+{
+    getopt_t *getopt = getopt_create();
+
+    getopt_add_bool(getopt, 'h', "help", 0, "Show this help");
+    getopt_add_string(getopt, 's', "stage", "brightness", "Stage to benchmark [brightness|integral|association|assignment|copy|refine|queue|match|phases|widths|batch|layout|ring|gray|suite|tracked]");
+    getopt_add_int(getopt, 'i', "iters", "100", "Repeat each measurement this many times");
+    getopt_add_int(getopt, 'W', "width", "1280", "Synthetic frame width");
+    getopt_add_int(getopt, 'H', "height", "720", "Synthetic frame height");
+    getopt_add_int(getopt, 'n', "candidates", "40", "Number of candidates per frame");
+    getopt_add_double(getopt, 'z', "size", "24", "Side length of synthetic anchors in pixels");
+    getopt_add_int(getopt, 't', "threads", "1", "Use this many CPU threads");
+    getopt_add_double(getopt, 'x', "decimate", "1.0", "Decimate input image by this factor");
+    getopt_add_int(getopt, 'b', "bits", "8", "Code width for the match, phases and suite stages");
+    getopt_add_string(getopt, 'T', "sweep-threads", "1,4", "Thread counts the suite stage sweeps");
+    getopt_add_string(getopt, 'D', "sweep-decimate", "1,2", "Decimation factors the suite stage sweeps, fractional ones too");
+    getopt_add_string(getopt, 'R', "sweep-refine", "0,1", "refine_edges settings the suite stage sweeps");
+    getopt_add_string(getopt, 'N', "sweep-candidates", "40", "Anchors per synthetic frame the suite stage sweeps");
+    getopt_add_string(getopt, 'C', "sweep-codes", "8", "Code table sizes the suite stage sweeps");
+    getopt_add_string(getopt, 'f', "format", "text", "Suite output format [text|csv|json]");
+    getopt_add_string(getopt, 'o', "output", "-", "Write the suite results to this file");
+
+    if (!getopt_parse(getopt, argc, argv, 1) || getopt_get_bool(getopt, "help"))
+    {
+        printf("Usage: %s [options]\n", argv[0]);
+        getopt_do_usage(getopt);
+        exit(0);
+    }
+
+    srandom(0);
+
+    const char *stage = getopt_get_string(getopt, "stage");
+    if (!strcmp(stage, "brightness"))
+    {
+        bench_brightness(getopt);
+    }
+    else if (!strcmp(stage, "integral"))
+    {
+        bench_integral(getopt);
+    }
+    else if (!strcmp(stage, "association"))
+    {
+        bench_association(getopt);
+    }
+    else if (!strcmp(stage, "assignment"))
+    {
+        bench_assignment(getopt);
+    }
+    else if (!strcmp(stage, "copy"))
+    {
+        bench_copy(getopt);
+    }
+    else if (!strcmp(stage, "refine"))
+    {
+        bench_refine(getopt);
+    }
+    else if (!strcmp(stage, "queue"))
+    {
+        bench_queue(getopt);
+    }
+    else if (!strcmp(stage, "match"))
+    {
+        bench_match(getopt);
+    }
+    else if (!strcmp(stage, "phases"))
+    {
+        bench_phases(getopt);
+    }
+    else if (!strcmp(stage, "widths"))
+    {
+        bench_widths(getopt);
+    }
+    else if (!strcmp(stage, "batch"))
+    {
+        bench_batch(getopt);
+    }
+    else if (!strcmp(stage, "layout"))
+    {
+        bench_layout(getopt);
+    }
+    else if (!strcmp(stage, "ring"))
+    {
+        bench_ring(getopt);
+    }
+    else if (!strcmp(stage, "gray"))
+    {
+        bench_gray(getopt);
+    }
+    else if (!strcmp(stage, "suite"))
+    {
+        bench_suite(getopt);
+    }
+    else if (!strcmp(stage, "tracked"))
+    {
+        bench_tracked(getopt);
+    }
+    else
+    {
+        printf("Unknown stage \"%s\".\n", stage);
+        exit(-1);
+    }
+
+    getopt_destroy(getopt);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+/** @file glitter_replay.c
+ *  @brief Runs the detector over a recorded session
+ *
+ *  Frames come from a file written by the webcam examples or glitter_synth
+ *  with -w, mapped into memory and handed to the detector in place, so a
+ *  replay runs at the speed of the detector or of the disk rather than of
+ *  image decoding. Detections go to stdout as CSV, the summary to stderr.
+ *
+ * Copyright (C) Wiselab CMU.
+ * @date July, 2020
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apriltag.h"
+
+#include "common/getopt.h"
+#include "common/image_u8.h"
+#include "common/math_util.h"
+#include "common/time_util.h"
+#include "common/zarray.h"
+
+#include "frame_file.h"
+
+#include "lightanchor.h"
+#include "lightanchor_detector.h"
+
+// detections reported per frame, any more are counted but not printed
+#define MAX_DETECTIONS 256
+
+/* registers a comma-separated list of hex codes, returns how many were accepted */
+static int add_codes(lightanchor_detector_t *ld, const char *list)
+{
+    int added = 0;
+    char *end;
+    for (const char *s = list; *s; s = (*end == ',') ? end + 1 : end)
+    {
+        uint32_t code = strtoul(s, &end, 16);
+        if (end == s)
+            break;
+        added += lightanchor_detector_add_code(ld, code) == 0;
+    }
+    return added;
+}
+
+int main(int argc, char *argv[])
+{
+    getopt_t *getopt = getopt_create();
+
+    getopt_add_bool(getopt, 'h', "help", 0, "Show this help");
+    getopt_add_bool(getopt, 'q', "quiet", 0, "Only print the summary");
+    getopt_add_int(getopt, 'i', "iters", "1", "Replay the recording this many times");
+    getopt_add_int(getopt, 't', "threads", "1", "Use this many CPU threads");
+    getopt_add_int(getopt, 'b', "bits", "8", "Code width");
+    getopt_add_string(getopt, 'c', "codes", "af", "Comma-separated hex codes to look for");
+    getopt_add_bool(getopt, '0', "refine-edges", 1, "Spend more time trying to align edges of tags");
+    getopt_add_bool(getopt, 'r', "roi", 0, "Only search around decoded anchors between full-frame scans");
+    getopt_add_int(getopt, 'F', "full-every", "30", "Scan the full frame at least every this many frames");
+    getopt_add_bool(getopt, 'S', "stats", 0, "Print the detector's per-stage timings and counters");
+
+    if (!getopt_parse(getopt, argc, argv, 1) || getopt_get_bool(getopt, "help") ||
+        zarray_size(getopt_get_extra_args(getopt)) != 1)
+    {
+        printf("Usage: %s [options] <recording>\n", argv[0]);
+        getopt_do_usage(getopt);
+        exit(0);
+    }
+
+    char *path;
+    zarray_get(getopt_get_extra_args(getopt), 0, &path);
+    frame_file_t *ff = frame_file_open(path);
+    if (ff == NULL)
+    {
+        fprintf(stderr, "Couldn't open %s as a recording\n", path);
+        exit(-1);
+    }
+
+    lightanchor_detector_t *ld = lightanchor_detector_create();
+    if (lightanchor_detector_set_code_width(ld, getopt_get_int(getopt, "bits")))
+    {
+        fprintf(stderr, "Unsupported code width.\n");
+        exit(-1);
+    }
+    if (add_codes(ld, getopt_get_string(getopt, "codes")) == 0)
+    {
+        fprintf(stderr, "No valid codes given.\n");
+        exit(-1);
+    }
+    // same thresholds as the JS detector's defaults
+    ld->range_thres = 20;
+    ld->ttl_frames = 8;
+    ld->thres_dist_shape = 50;
+    ld->thres_dist_shape_ttl = 20;
+    ld->thres_dist_center = 25;
+    ld->track_roi = getopt_get_bool(getopt, "roi");
+    ld->roi_full_every = getopt_get_int(getopt, "full-every");
+    ld->collect_stats = getopt_get_bool(getopt, "stats");
+
+    apriltag_detector_t *td = apriltag_detector_create();
+    td->nthreads = getopt_get_int(getopt, "threads");
+    td->refine_edges = getopt_get_bool(getopt, "refine-edges");
+    // recordings are full resolution, edge refinement should not search as if they were decimated
+    td->quad_decimate = 1;
+
+    int quiet = getopt_get_bool(getopt, "quiet");
+    if (!quiet)
+        printf("frame,utime,id,code,cx,cy\n");
+
+    int iters = getopt_get_int(getopt, "iters");
+    int64_t ndetections = 0;
+    lightanchor_detection_t lightanchors[MAX_DETECTIONS];
+
+    int64_t t0 = utime_now();
+    for (int iter = 0; iter < iters; iter++)
+    {
+        for (int f = 0; f < ff->nframes; f++)
+        {
+            int64_t utime;
+            image_u8_t im = frame_file_get(ff, f, &utime);
+
+            zarray_t *quads = detect_quads_tracked(td, ld, &im);
+            int n = decode_tags_into(td, ld, quads, &im, lightanchors, MAX_DETECTIONS);
+            ndetections += n;
+
+            if (quiet)
+                continue;
+
+            for (int i = 0; i < imin(n, MAX_DETECTIONS); i++)
+            {
+                lightanchor_detection_t *det = &lightanchors[i];
+                printf("%d,%" PRId64 ",%u,%u,%.2f,%.2f\n", f, utime, det->id, det->match_code,
+                       det->c[0], det->c[1]);
+            }
+        }
+    }
+    int64_t us = utime_now() - t0;
+
+    int64_t frames = (int64_t)iters * ff->nframes;
+    double bytes = (double)frames * ff->width * ff->height;
+    fprintf(stderr, "%" PRId64 " frames of %dx%d from %s\n", frames, ff->width, ff->height, path);
+    fprintf(stderr, "  %-28s %10.1f\n", "frames/s", us > 0 ? 1e6 * frames / us : 0);
+    fprintf(stderr, "  %-28s %10.1f\n", "MB/s of pixels", us > 0 ? bytes / us : 0);
+    fprintf(stderr, "  %-28s %10.2f\n", "detections/frame", frames > 0 ? (double)ndetections / frames : 0);
+
+    if (ld->collect_stats)
+    {
+        detector_stats_t stats;
+        lightanchor_detector_get_stats(ld, &stats);
+        uint64_t n = stats.frames > 0 ? stats.frames : 1;
+
+        fprintf(stderr, "per frame, stages summed over threads\n");
+        for (int i = 0; i < STAGE_COUNT; i++)
+            fprintf(stderr, "  %-28s %10.3f ms\n", detector_stage_name(i), stats.ns[i] / 1e6 / n);
+        for (int i = 0; i < COUNTER_COUNT; i++)
+            fprintf(stderr, "  %-28s %10.2f\n", detector_counter_name(i), (double)stats.counters[i] / n);
+    }
+
+    frame_file_destroy(ff);
+    lightanchor_detector_destroy(ld);
+    apriltag_detector_destroy(td);
+    getopt_destroy(getopt);
+
+    return 0;
+}
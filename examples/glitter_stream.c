@@ -0,0 +1,212 @@
+/** @file glitter_stream.c
+ *  @brief Runs the detector over video piped in from another process
+ *
+ *  Reads Y4M, or raw gray8 frames of a given size, from stdin or a FIFO and
+ *  writes the detections of every frame to stdout as CSV as soon as the frame
+ *  is done, e.g.
+ *
+ *      ffmpeg -i input.mp4 -f yuv4mpegpipe - | glitter_stream -c af
+ *      ffmpeg -i input.mp4 -f rawvideo -pix_fmt gray - | glitter_stream -W 1280 -H 720
+ *
+ *  The summary goes to stderr.
+ *
+ * Copyright (C) Wiselab CMU.
+ * @date July, 2020
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "apriltag.h"
+
+#include "common/getopt.h"
+#include "common/image_u8.h"
+#include "common/math_util.h"
+#include "common/time_util.h"
+#include "common/zarray.h"
+
+#include "frame_stream.h"
+#include "gray_convert.h"
+
+#include "lightanchor.h"
+#include "lightanchor_detector.h"
+
+// detections reported per frame, any more are counted but not printed
+#define MAX_DETECTIONS 256
+
+/* registers a comma-separated list of hex codes, returns how many were accepted */
+static int add_codes(lightanchor_detector_t *ld, const char *list)
+{
+    int added = 0;
+    char *end;
+    for (const char *s = list; *s; s = (*end == ',') ? end + 1 : end)
+    {
+        uint32_t code = strtoul(s, &end, 16);
+        if (end == s)
+            break;
+        added += lightanchor_detector_add_code(ld, code) == 0;
+    }
+    return added;
+}
+
+/* from decimated back to input pixel coordinates, as result_ring_write() does */
+static inline double undecimate(double v, int decimate)
+{
+    return (v - 0.5) * decimate + 0.5;
+}
+
+int main(int argc, char *argv[])
+{
+    getopt_t *getopt = getopt_create();
+
+    getopt_add_bool(getopt, 'h', "help", 0, "Show this help");
+    getopt_add_bool(getopt, 'q', "quiet", 0, "Only print the summary");
+    getopt_add_int(getopt, 'W', "width", "0", "Width of raw gray8 input; without it the input is Y4M");
+    getopt_add_int(getopt, 'H', "height", "0", "Height of raw gray8 input");
+    getopt_add_int(getopt, 'x', "decimate", "1", "Decimate frames by this factor before detection");
+    getopt_add_int(getopt, 't', "threads", "1", "Use this many CPU threads");
+    getopt_add_int(getopt, 'b', "bits", "8", "Code width");
+    getopt_add_string(getopt, 'c', "codes", "af", "Comma-separated hex codes to look for");
+    getopt_add_bool(getopt, '0', "refine-edges", 1, "Spend more time trying to align edges of tags");
+    getopt_add_bool(getopt, 'r', "roi", 0, "Only search around decoded anchors between full-frame scans");
+    getopt_add_int(getopt, 'F', "full-every", "30", "Scan the full frame at least every this many frames");
+    getopt_add_bool(getopt, 'S', "stats", 0, "Print the detector's per-stage timings and counters");
+
+    if (!getopt_parse(getopt, argc, argv, 1) || getopt_get_bool(getopt, "help") ||
+        zarray_size(getopt_get_extra_args(getopt)) > 1)
+    {
+        printf("Usage: %s [options] [input, default stdin]\n", argv[0]);
+        getopt_do_usage(getopt);
+        exit(0);
+    }
+
+    int fd = STDIN_FILENO;
+    if (zarray_size(getopt_get_extra_args(getopt)) == 1)
+    {
+        char *path;
+        zarray_get(getopt_get_extra_args(getopt), 0, &path);
+        if (strcmp(path, "-") && (fd = open(path, O_RDONLY)) < 0)
+        {
+            fprintf(stderr, "Couldn't open %s\n", path);
+            exit(-1);
+        }
+    }
+
+    int width = getopt_get_int(getopt, "width");
+    int height = getopt_get_int(getopt, "height");
+    frame_stream_t *fs = (width > 0 || height > 0) ?
+        frame_stream_create_raw(fd, width, height) :
+        frame_stream_create_y4m(fd);
+    if (fs == NULL)
+    {
+        fprintf(stderr, (width > 0 || height > 0) ? "Both the width and height of raw input are needed.\n" :
+                        "Input is not an 8-bit Y4M stream, give -W and -H for raw gray8.\n");
+        exit(-1);
+    }
+
+    lightanchor_detector_t *ld = lightanchor_detector_create();
+    if (lightanchor_detector_set_code_width(ld, getopt_get_int(getopt, "bits")))
+    {
+        fprintf(stderr, "Unsupported code width.\n");
+        exit(-1);
+    }
+    if (add_codes(ld, getopt_get_string(getopt, "codes")) == 0)
+    {
+        fprintf(stderr, "No valid codes given.\n");
+        exit(-1);
+    }
+    // same thresholds as the JS detector's defaults
+    ld->range_thres = 20;
+    ld->ttl_frames = 8;
+    ld->thres_dist_shape = 50;
+    ld->thres_dist_shape_ttl = 20;
+    ld->thres_dist_center = 25;
+    ld->track_roi = getopt_get_bool(getopt, "roi");
+    ld->roi_full_every = getopt_get_int(getopt, "full-every");
+    ld->collect_stats = getopt_get_bool(getopt, "stats");
+
+    int decimate = imax(1, getopt_get_int(getopt, "decimate"));
+    apriltag_detector_t *td = apriltag_detector_create();
+    td->nthreads = getopt_get_int(getopt, "threads");
+    td->refine_edges = getopt_get_bool(getopt, "refine-edges");
+    td->quad_decimate = decimate;
+
+    // every frame has the stream's size, so the decimated copy is allocated once
+    image_u8_t *decimated = NULL;
+    if (decimate > 1)
+        decimated = image_u8_create(gray_decimated_size(fs->width, decimate),
+                                    gray_decimated_size(fs->height, decimate));
+
+    int quiet = getopt_get_bool(getopt, "quiet");
+    if (!quiet)
+        printf("frame,id,code,cx,cy\n");
+
+    int64_t ndetections = 0;
+    lightanchor_detection_t lightanchors[MAX_DETECTIONS];
+
+    int64_t t0 = utime_now();
+    image_u8_t *im;
+    while ((im = frame_stream_next(fs)) != NULL)
+    {
+        if (decimated)
+        {
+            gray_convert(im->buf, im->width, im->height, im->stride, 1, GRAY_RED, decimate, decimated);
+            im = decimated;
+        }
+
+        zarray_t *quads = detect_quads_tracked(td, ld, im);
+        int n = decode_tags_into(td, ld, quads, im, lightanchors, MAX_DETECTIONS);
+        ndetections += n;
+
+        if (quiet || n == 0)
+            continue;
+
+        for (int i = 0; i < imin(n, MAX_DETECTIONS); i++)
+        {
+            lightanchor_detection_t *det = &lightanchors[i];
+            printf("%d,%u,%u,%.2f,%.2f\n", fs->nframes - 1, det->id, det->match_code,
+                   undecimate(det->c[0], decimate), undecimate(det->c[1], decimate));
+        }
+        // downstream readers see each frame as soon as it is done
+        fflush(stdout);
+    }
+    int64_t us = utime_now() - t0;
+
+    if (fs->error)
+        fprintf(stderr, "Input ended on a read error or a truncated frame\n");
+
+    int frames = fs->nframes;
+    fprintf(stderr, "%d frames of %dx%d\n", frames, fs->width, fs->height);
+    fprintf(stderr, "  %-28s %10.1f\n", "frames/s", us > 0 ? 1e6 * frames / us : 0);
+    fprintf(stderr, "  %-28s %10.2f\n", "ms/frame waiting on input", frames > 0 ? fs->wait_us / 1000.0 / frames : 0);
+    fprintf(stderr, "  %-28s %10.2f\n", "detections/frame", frames > 0 ? (double)ndetections / frames : 0);
+
+    if (ld->collect_stats)
+    {
+        detector_stats_t stats;
+        lightanchor_detector_get_stats(ld, &stats);
+        uint64_t n = stats.frames > 0 ? stats.frames : 1;
+
+        fprintf(stderr, "per frame, stages summed over threads\n");
+        for (int i = 0; i < STAGE_COUNT; i++)
+            fprintf(stderr, "  %-28s %10.3f ms\n", detector_stage_name(i), stats.ns[i] / 1e6 / n);
+        for (int i = 0; i < COUNTER_COUNT; i++)
+            fprintf(stderr, "  %-28s %10.2f\n", detector_counter_name(i), (double)stats.counters[i] / n);
+    }
+
+    int error = fs->error;
+    frame_stream_destroy(fs);
+    if (fd != STDIN_FILENO)
+        close(fd);
+
+    image_u8_destroy(decimated);
+    lightanchor_detector_destroy(ld);
+    apriltag_detector_destroy(td);
+    getopt_destroy(getopt);
+
+    return error ? 1 : 0;
+}
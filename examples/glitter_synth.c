@@ -0,0 +1,301 @@
+/** @file glitter_synth.c
+ *  @brief Renders synthetic blinking-anchor sequences, and runs the detector over them
+ *
+ *  Frames can be written out as PNM files next to a CSV of ground truth (code,
+ *  exposure and corners of every anchor in every frame), or fed straight to
+ *  the detector to measure acquisition latency, decoding errors and throughput.
+ *  A run that reports a wrong code exits with status 1.
+ *
+ * Copyright (C) Wiselab CMU.
+ * @date July, 2020
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "apriltag.h"
+
+#include "common/getopt.h"
+#include "common/image_u8.h"
+#include "common/math_util.h"
+#include "common/time_util.h"
+#include "common/zarray.h"
+
+#include "bit_match.h"
+#include "frame_file.h"
+#include "spatial_grid.h"
+#include "synth_sequence.h"
+
+#include "lightanchor.h"
+#include "lightanchor_detector.h"
+
+static int compare_int(const void *_a, const void *_b)
+{
+    return *(const int *)_a - *(const int *)_b;
+}
+
+/* registers n random codes, returns how many were accepted */
+static int add_random_codes(lightanchor_detector_t *ld, int n)
+{
+    int added = 0;
+    uint32_t mask = (uint32_t)((1ULL << ld->code_width) - 1);
+    for (int tries = 0; added < n && tries < 64*n + 4096; tries++)
+        added += lightanchor_detector_add_code(ld, ((uint32_t)random() << 1 ^ random()) & mask) == 0;
+    return added;
+}
+
+int main(int argc, char *argv[])
+{
+    getopt_t *getopt = getopt_create();
+
+    getopt_add_bool(getopt, 'h', "help", 0, "Show this help");
+    getopt_add_int(getopt, 'i', "frames", "120", "Number of frames to render");
+    getopt_add_int(getopt, 'W', "width", "1280", "Frame width");
+    getopt_add_int(getopt, 'H', "height", "720", "Frame height");
+    getopt_add_int(getopt, 'n', "anchors", "40", "Number of anchors");
+    getopt_add_double(getopt, 'z', "size", "24", "Side length of anchors in pixels");
+    getopt_add_double(getopt, 'j', "size-jitter", "0", "Vary sizes by up to this fraction");
+    getopt_add_double(getopt, 'v', "speed", "0", "Motion in pixels per frame");
+    getopt_add_double(getopt, 'r', "spin", "0", "Rotation in radians per frame");
+    getopt_add_int(getopt, 'k', "background", "10", "Gray level of the background");
+    getopt_add_int(getopt, 'l', "off", "90", "Gray level of an anchor with its LED off");
+    getopt_add_int(getopt, 'u', "on", "250", "Gray level of an anchor with its LED on");
+    getopt_add_double(getopt, 'g', "noise", "0", "Standard deviation of gaussian pixel noise");
+    getopt_add_int(getopt, 'B', "blur", "0", "Box blur radius in pixels");
+    getopt_add_double(getopt, 'm', "frames-per-bit", "2", "Camera frames per code bit, 2 is the nominal rate");
+    getopt_add_int(getopt, 'b', "bits", "8", "Code width");
+    getopt_add_int(getopt, 'c', "codes", "8", "Number of registered codes");
+    getopt_add_int(getopt, 's', "seed", "1", "Seed of the sequence and the codes");
+    getopt_add_string(getopt, 'o', "output", "", "Write frame_NNNNN.pnm and truth.csv to this directory");
+    getopt_add_string(getopt, 'w', "record", "", "Write the frames to this file, for glitter_replay");
+    getopt_add_bool(getopt, 'd', "detect", 0, "Run the detector over the sequence and report");
+    getopt_add_int(getopt, 't', "threads", "1", "Use this many CPU threads");
+    getopt_add_bool(getopt, 'S', "stats", 0, "Print the detector's per-stage timings and counters");
+
+    if (!getopt_parse(getopt, argc, argv, 1) || getopt_get_bool(getopt, "help"))
+    {
+        printf("Usage: %s [options]\n", argv[0]);
+        getopt_do_usage(getopt);
+        exit(0);
+    }
+
+    synth_params_t params;
+    synth_params_init(&params);
+    params.width = getopt_get_int(getopt, "width");
+    params.height = getopt_get_int(getopt, "height");
+    params.nanchors = getopt_get_int(getopt, "anchors");
+    params.size = getopt_get_double(getopt, "size");
+    params.size_jitter = getopt_get_double(getopt, "size-jitter");
+    params.speed = getopt_get_double(getopt, "speed");
+    params.spin = getopt_get_double(getopt, "spin");
+    params.background = getopt_get_int(getopt, "background");
+    params.off = getopt_get_int(getopt, "off");
+    params.on = getopt_get_int(getopt, "on");
+    params.noise = getopt_get_double(getopt, "noise");
+    params.blur = getopt_get_int(getopt, "blur");
+    params.frames_per_bit = getopt_get_double(getopt, "frames-per-bit");
+    params.seed = getopt_get_int(getopt, "seed");
+
+    lightanchor_detector_t *ld = lightanchor_detector_create();
+    if (lightanchor_detector_set_code_width(ld, getopt_get_int(getopt, "bits")))
+    {
+        printf("Unsupported code width.\n");
+        exit(-1);
+    }
+    ld->range_thres = 20;
+    ld->ttl_frames = 8;
+    ld->thres_dist_shape = 50;
+    ld->thres_dist_shape_ttl = 20;
+    ld->thres_dist_center = 25;
+
+    srandom(params.seed);
+    int ncodes = add_random_codes(ld, getopt_get_int(getopt, "codes"));
+    uint32_t *codes = malloc(ncodes * sizeof(uint32_t));
+    for (int i = 0; i < ncodes; i++)
+    {
+        glitter_code_t *code;
+        zarray_get_volatile(ld->codes, i, &code);
+        codes[i] = code->code;
+    }
+
+    synth_sequence_t *seq = synth_sequence_create(&params, codes, ncodes, ld->code_width);
+    image_u8_t *im = image_u8_create(params.width, params.height);
+
+    const char *dir = getopt_get_string(getopt, "output");
+    FILE *truth = NULL;
+    if (strlen(dir) > 0)
+    {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/truth.csv", dir);
+        truth = fopen(path, "w");
+        if (truth == NULL)
+        {
+            printf("Couldn't open %s\n", path);
+            exit(-1);
+        }
+        synth_sequence_write_truth_header(truth);
+    }
+
+    const char *record_path = getopt_get_string(getopt, "record");
+    frame_file_t *recording = NULL;
+    if (strlen(record_path) > 0)
+    {
+        recording = frame_file_create(record_path, params.width, params.height);
+        if (recording == NULL)
+        {
+            printf("Couldn't create %s\n", record_path);
+            exit(-1);
+        }
+    }
+
+    int detect = getopt_get_bool(getopt, "detect");
+    ld->collect_stats = getopt_get_bool(getopt, "stats");
+    apriltag_detector_t *td = apriltag_detector_create();
+    td->nthreads = getopt_get_int(getopt, "threads");
+    td->refine_edges = 0;
+
+    // frame each anchor was first acquired with its own code, -1 until then
+    int *acquired = malloc(imax(1, params.nanchors) * sizeof(int));
+    for (int i = 0; i < params.nanchors; i++)
+        acquired[i] = -1;
+
+    spatial_grid_t *grid = spatial_grid_create();
+    int frames = getopt_get_int(getopt, "frames");
+    int64_t detect_us = 0;
+    int ndetections = 0, nwrong = 0, nunmatched = 0;
+
+    for (int f = 0; f < frames; f++)
+    {
+        synth_sequence_render(seq, im);
+
+        if (truth)
+        {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/frame_%05d.pnm", dir, f);
+            image_u8_write_pnm(im, path);
+            synth_sequence_write_truth(seq, truth);
+        }
+
+        // timestamps of a 30 fps camera
+        if (recording)
+            frame_file_write(recording, im, f * 1000000LL / 30);
+
+        if (!detect)
+            continue;
+
+        int64_t t0 = utime_now();
+        zarray_t *quads = detect_quads_tracked(td, ld, im);
+        decode_tags(td, ld, quads, im);
+        detect_us += utime_now() - t0;
+
+        // events are matched to the nearest anchor of this frame
+        spatial_grid_reset(grid, params.size * (1 + params.size_jitter), seq->nanchors);
+        for (int i = 0; i < seq->nanchors; i++)
+            spatial_grid_add(grid, seq->anchors[i].c);
+
+        zarray_t *events = lightanchor_detector_events(ld);
+        for (int i = 0; i < zarray_size(events); i++)
+        {
+            lightanchor_event_t *ev;
+            zarray_get_volatile(events, i, &ev);
+            if (ev->type == LIGHTANCHOR_LOST)
+                continue;
+
+            int nearest = -1;
+            double best = HUGE_VAL;
+            zarray_t *near = spatial_grid_query(grid, ev->c);
+            for (int j = 0; j < zarray_size(near); j++)
+            {
+                int id;
+                zarray_get(near, j, &id);
+                synth_anchor_t *a = &seq->anchors[id];
+                double d = sqrt(sq(a->c[0] - ev->c[0]) + sq(a->c[1] - ev->c[1]));
+                if (d < a->size / 2 && d < best)
+                {
+                    best = d;
+                    nearest = id;
+                }
+            }
+
+            ndetections++;
+            if (nearest < 0)
+            {
+                nunmatched++;
+            }
+            else if (seq->anchors[nearest].code != ev->match_code)
+            {
+                nwrong++;
+            }
+            else if (acquired[nearest] < 0)
+            {
+                acquired[nearest] = f;
+            }
+        }
+    }
+
+    if (truth)
+    {
+        fclose(truth);
+        printf("Wrote %d frames and their ground truth to %s\n", frames, dir);
+    }
+
+    if (recording)
+    {
+        printf("Recorded %d frames to %s, replay with -b %d -c ", recording->nframes, record_path,
+               ld->code_width);
+        for (int i = 0; i < ncodes; i++)
+            printf("%s%x", i ? "," : "", codes[i]);
+        printf("\n");
+        frame_file_destroy(recording);
+    }
+
+    if (detect)
+    {
+        int nacquired = 0;
+        for (int i = 0; i < params.nanchors; i++)
+            if (acquired[i] >= 0)
+                acquired[nacquired++] = acquired[i];
+        qsort(acquired, nacquired, sizeof(int), compare_int);
+
+        printf("%d anchors, %d codes of %d bits, %d frames of %dx%d\n", params.nanchors, ncodes,
+               ld->code_width, frames, params.width, params.height);
+        printf("  %-28s %10.1f\n", "frames/s", detect_us > 0 ? 1e6 * frames / detect_us : 0);
+        printf("  %-28s %10.2f\n", "ms/frame", detect_us / 1000.0 / frames);
+        printf("  %-28s %6d/%-6d\n", "acquired", nacquired, params.nanchors);
+        if (nacquired > 0)
+            printf("  %-28s %4d %4d %4d\n", "acquired at frame p50/p90/max",
+                   acquired[(nacquired - 1) / 2], acquired[(int)ceil(0.9 * nacquired) - 1],
+                   acquired[nacquired - 1]);
+        printf("  %-28s %10.2f\n", "detections/frame", (double)ndetections / frames);
+        printf("  %-28s %10d\n", "wrong code", nwrong);
+        printf("  %-28s %10d\n", "not on an anchor", nunmatched);
+    }
+
+    if (detect && ld->collect_stats)
+    {
+        detector_stats_t stats;
+        lightanchor_detector_get_stats(ld, &stats);
+        uint64_t frames = stats.frames > 0 ? stats.frames : 1;
+
+        printf("per frame, stages summed over threads\n");
+        for (int i = 0; i < STAGE_COUNT; i++)
+            printf("  %-28s %10.3f ms\n", detector_stage_name(i), stats.ns[i] / 1e6 / frames);
+        for (int i = 0; i < COUNTER_COUNT; i++)
+            printf("  %-28s %10.2f\n", detector_counter_name(i), (double)stats.counters[i] / frames);
+    }
+
+    spatial_grid_destroy(grid);
+    free(acquired);
+    image_u8_destroy(im);
+    synth_sequence_destroy(seq);
+    free(codes);
+    lightanchor_detector_destroy(ld);
+    apriltag_detector_destroy(td);
+    getopt_destroy(getopt);
+
+    // a detection carrying another anchor's code is a decoding bug, not noise
+    return nwrong > 0 ? 1 : 0;
+}
@@ -45,6 +45,7 @@ either expressed or implied, of the Regents of The University of Michigan.
 #include "common/image_u8x4.h"
 #include "common/pjpeg.h"
 #include "common/zarray.h"
+#include "common/math_util.h"
 
 #include "lightanchor.h"
 #include "lightanchor_detector.h"
@@ -55,6 +56,9 @@ either expressed or implied, of the Regents of The University of Michigan.
 //
 // tagtest [options] input.pnm
 
+// detections reported per image, any more are counted but not printed
+#define MAX_DETECTIONS 256
+
 int main(int argc, char *argv[])
 {
     getopt_t *getopt = getopt_create();
@@ -173,12 +177,13 @@ int main(int argc, char *argv[])
             continue;
         }
 
-        zarray_t *quads = detect_quads(td, im);
+        zarray_t *quads = detect_quads_scratch(td, im, &ld->quad_im);
 
-        zarray_t *lightanchors = decode_tags(td, ld, quads, im);
+        lightanchor_detection_t lightanchors[MAX_DETECTIONS];
+        int ndetections = decode_tags_into(td, ld, quads, im, lightanchors, MAX_DETECTIONS);
 
         if (!quiet)
-            printf("Found %d lightanchors.\n", zarray_size(lightanchors));
+            printf("Found %d lightanchors.\n", ndetections);
 
         // output ps file
         image_u8_t *darker = image_u8_copy(im);
@@ -196,10 +201,9 @@ int main(int argc, char *argv[])
 
         image_u8_destroy(darker);
 
-        for (int i = 0; i < zarray_size(lightanchors); i++)
+        for (int i = 0; i < imin(ndetections, MAX_DETECTIONS); i++)
         {
-            lightanchor_t *lightanchor;
-            zarray_get(lightanchors, i, &lightanchor);
+            lightanchor_detection_t *lightanchor = &lightanchors[i];
 
             float rgb[3];
             int bias = 100;
@@ -218,7 +222,7 @@ int main(int argc, char *argv[])
             fprintf(f, "%f %f 1 0 360 arc stroke\n", lightanchor->c[0], lightanchor->c[1]);
 
             if (!quiet)
-                printf("lightanchor %d [%.2f, %.2f]: (%.2f, %.2f) (%.2f, %.2f) (%.2f, %.2f) (%.2f, %.2f)\n", i, lightanchor->c[0], lightanchor->c[1],
+                printf("lightanchor %u [%.2f, %.2f]: (%.2f, %.2f) (%.2f, %.2f) (%.2f, %.2f) (%.2f, %.2f)\n", lightanchor->id, lightanchor->c[0], lightanchor->c[1],
                         lightanchor->p[0][0], lightanchor->p[0][1], lightanchor->p[1][0], lightanchor->p[1][1], lightanchor->p[2][0], lightanchor->p[2][1], lightanchor->p[3][0], lightanchor->p[3][1]);
         }
 
@@ -11,15 +11,20 @@ extern "C" {
 #include "common/image_u8.h"
 #include "common/image_u8x4.h"
 #include "common/pjpeg.h"
+#include "common/time_util.h"
 #include "common/zarray.h"
 
 #include "lightanchor.h"
 #include "lightanchor_detector.h"
+#include "frame_file.h"
 }
 
 using namespace std;
 using namespace cv;
 
+// anchors drawn per frame
+#define MAX_DETECTIONS 256
+
 
 int main(int argc, char *argv[])
 {
@@ -33,6 +38,9 @@ int main(int argc, char *argv[])
     getopt_add_double(getopt, 'x', "decimate", "2.0", "Decimate input image by this factor");
     getopt_add_double(getopt, 'b', "blur", "0.0", "Apply low-pass blur to input; negative sharpens");
     getopt_add_bool(getopt, '0', "refine-edges", 1, "Spend more time trying to align edges of tags");
+    getopt_add_bool(getopt, 'r', "roi", 0, "Only search around decoded anchors between full-frame scans");
+    getopt_add_int(getopt, 'F', "full-every", "30", "Scan the full frame at least every this many frames");
+    getopt_add_string(getopt, 'w', "record", "", "Record the gray frames to this file, for glitter_replay");
 
     if (!getopt_parse(getopt, argc, argv, 1) || getopt_get_bool(getopt, "help")) {
         printf("Usage: %s [options]\n", argv[0]);
@@ -74,13 +82,19 @@ int main(int argc, char *argv[])
 
     lightanchor_detector_t *ld = lightanchor_detector_create();
     lightanchor_detector_add_code(ld, 0xaf);
+    ld->track_roi = getopt_get_bool(getopt, "roi");
+    ld->roi_full_every = getopt_get_int(getopt, "full-every");
 
     int frames = 0;
 
     time_t start, end;
     time(&start);
 
+    const char *record_path = getopt_get_string(getopt, "record");
+    frame_file_t *recording = NULL;
+
     Mat frame, gray;
+    lightanchor_detection_t lightanchors[MAX_DETECTIONS];
     while (true) {
         cap >> frame;
         if (frame.empty())
@@ -98,15 +112,26 @@ int main(int argc, char *argv[])
             .buf = gray.data
         };
 
-        zarray_t *quads = detect_quads(td, &im);
+        // the frames exactly as the detector sees them
+        if (strlen(record_path) > 0) {
+            if (recording == NULL) {
+                recording = frame_file_create(record_path, im.width, im.height);
+                if (recording == NULL) {
+                    cerr << "Couldn't create " << record_path << endl;
+                    return -1;
+                }
+            }
+            frame_file_write(recording, &im, utime_now());
+        }
+
+        zarray_t *quads = detect_quads_tracked(td, ld, &im);
 
-        zarray_t *lightanchors = decode_tags(td, ld, quads, &im);
-        // cout << zarray_size(lightanchors) << " possible lightanchors detected" << endl;
+        int ndetections = decode_tags_into(td, ld, quads, &im, lightanchors, MAX_DETECTIONS);
+        // cout << ndetections << " possible lightanchors detected" << endl;
 
         // Draw quad outlines
-        for (int i = 0; i < zarray_size(lightanchors); i++) {
-            lightanchor_t *lightanchor;
-            zarray_get(lightanchors, i, &lightanchor);
+        for (int i = 0; i < min(ndetections, MAX_DETECTIONS); i++) {
+            lightanchor_detection_t *lightanchor = &lightanchors[i];
 
             line(frame, Point(lightanchor->p[0][0], lightanchor->p[0][1]),
                     Point(lightanchor->p[1][0], lightanchor->p[1][1]),
@@ -122,9 +147,10 @@ int main(int argc, char *argv[])
                     Scalar(0xff, 0, 0), 1);
             circle(frame, Point(lightanchor->c[0], lightanchor->c[1]), 1,
                    Scalar(0, 0, 0xff), 2);
-            stringstream brightness;
-            brightness << "0x" << hex << +(int)(lightanchor->valid & 0xffff);
-            putText(frame, brightness.str(), Point(lightanchor->c[0], lightanchor->c[1]),
+            // track id stays with the anchor across frames
+            stringstream label;
+            label << "#" << lightanchor->id << " 0x" << hex << lightanchor->match_code;
+            putText(frame, label.str(), Point(lightanchor->c[0], lightanchor->c[1]),
                     FONT_HERSHEY_DUPLEX, 0.5,
                     Scalar(0, 0, 0xff), 1);
         }
@@ -141,6 +167,11 @@ int main(int argc, char *argv[])
     fps = frames / seconds;
     cout << "Approx FPS: " << fps << endl;
 
+    if (recording) {
+        cout << "Recorded " << recording->nframes << " frames to " << record_path << endl;
+        frame_file_destroy(recording);
+    }
+
     apriltag_detector_destroy(td);
 
     lightanchor_detector_destroy(ld);
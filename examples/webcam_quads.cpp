@@ -10,9 +10,11 @@ extern "C" {
 #include "common/image_u8.h"
 #include "common/image_u8x4.h"
 #include "common/pjpeg.h"
+#include "common/time_util.h"
 #include "common/zarray.h"
 
 #include "lightanchor_detector.h"
+#include "frame_file.h"
 }
 
 using namespace std;
@@ -31,6 +33,7 @@ int main(int argc, char *argv[])
     getopt_add_double(getopt, 'x', "decimate", "2.0", "Decimate input image by this factor");
     getopt_add_double(getopt, 'b', "blur", "0.0", "Apply low-pass blur to input; negative sharpens");
     getopt_add_bool(getopt, '0', "refine-edges", 1, "Spend more time trying to align edges of tags");
+    getopt_add_string(getopt, 'w', "record", "", "Record the gray frames to this file, for glitter_replay");
 
     if (!getopt_parse(getopt, argc, argv, 1) || getopt_get_bool(getopt, "help")) {
         printf("Usage: %s [options]\n", argv[0]);
@@ -67,6 +70,9 @@ int main(int argc, char *argv[])
     td->debug = getopt_get_bool(getopt, "debug");
     td->refine_edges = getopt_get_bool(getopt, "refine-edges");
 
+    const char *record_path = getopt_get_string(getopt, "record");
+    frame_file_t *recording = NULL;
+
     Mat frame, gray;
     while (true) {
         cap >> frame;
@@ -84,7 +90,20 @@ int main(int argc, char *argv[])
             .buf = gray.data
         };
 
-        zarray_t *quads = detect_quads(td, &im);
+        // before detection, which may work on the frame in place
+        if (strlen(record_path) > 0) {
+            if (recording == NULL) {
+                recording = frame_file_create(record_path, im.width, im.height);
+                if (recording == NULL) {
+                    cerr << "Couldn't create " << record_path << endl;
+                    return -1;
+                }
+            }
+            frame_file_write(recording, &im, utime_now());
+        }
+
+        // gray is not used again, let quad detection work on it in place
+        zarray_t *quads = detect_quads_scratch(td, &im, NULL);
         cout << zarray_size(quads) << " quads detected" << endl;
 
         // Draw quad outlines
@@ -114,6 +133,11 @@ int main(int argc, char *argv[])
             break;
     }
 
+    if (recording) {
+        cout << "Recorded " << recording->nframes << " frames to " << record_path << endl;
+        frame_file_destroy(recording);
+    }
+
     apriltag_detector_destroy(td);
 
     tag36h11_destroy(tf);
@@ -0,0 +1,285 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "assignment.h"
+
+struct assignment_arc
+{
+    int col;
+    double cost;
+};
+
+struct heap_entry
+{
+    double d;
+    int col;
+};
+
+/* zarray_add(), counting in as->grows when the array has to be reallocated */
+static void add_counted(assignment_t *as, zarray_t *za, const void *p)
+{
+    int alloc = za->alloc;
+    zarray_add(za, p);
+    as->grows += za->alloc != alloc;
+}
+
+static void heap_push(assignment_t *as, double d, int col)
+{
+    zarray_t *heap = as->heap;
+    struct heap_entry e = { d, col };
+    add_counted(as, heap, &e);
+
+    struct heap_entry *h = (struct heap_entry *)heap->data;
+    int i = zarray_size(heap) - 1;
+    while (i > 0 && h[(i - 1) / 2].d > h[i].d)
+    {
+        struct heap_entry t = h[i];
+        h[i] = h[(i - 1) / 2];
+        h[(i - 1) / 2] = t;
+        i = (i - 1) / 2;
+    }
+}
+
+static struct heap_entry heap_pop(zarray_t *heap)
+{
+    struct heap_entry *h = (struct heap_entry *)heap->data;
+    struct heap_entry top = h[0];
+
+    int n = zarray_size(heap) - 1;
+    h[0] = h[n];
+    zarray_truncate(heap, n);
+
+    int i = 0;
+    while (1)
+    {
+        int l = 2*i + 1, r = l + 1, m = i;
+        if (l < n && h[l].d < h[m].d) m = l;
+        if (r < n && h[r].d < h[m].d) m = r;
+        if (m == i)
+            break;
+        struct heap_entry t = h[i];
+        h[i] = h[m];
+        h[m] = t;
+        i = m;
+    }
+    return top;
+}
+
+assignment_t *assignment_create()
+{
+    assignment_t *as = calloc(1, sizeof(assignment_t));
+    as->row_start = zarray_create(sizeof(int));
+    as->arcs = zarray_create(sizeof(struct assignment_arc));
+    as->heap = zarray_create(sizeof(struct heap_entry));
+    as->settled_cols = zarray_create(sizeof(int));
+    return as;
+}
+
+void assignment_reset(assignment_t *as, int ncols)
+{
+    as->nrows = 0;
+    as->ncols = ncols;
+    zarray_clear(as->arcs);
+    zarray_clear(as->row_start);
+
+    int zero = 0;
+    add_counted(as, as->row_start, &zero);
+}
+
+void assignment_add_row(assignment_t *as)
+{
+    // close the previous row, if any
+    if (as->nrows > 0)
+    {
+        int end = zarray_size(as->arcs);
+        add_counted(as, as->row_start, &end);
+    }
+    as->nrows++;
+}
+
+void assignment_add_arc(assignment_t *as, int col, double cost)
+{
+    struct assignment_arc arc = { col, cost };
+    add_counted(as, as->arcs, &arc);
+}
+
+static void ensure_capacity(assignment_t *as)
+{
+    int n = as->ncols + as->nrows;
+    if (n <= as->capacity)
+        return;
+
+    as->capacity = n;
+    as->grows++;
+    as->col_of_row = realloc(as->col_of_row, n * sizeof(int));
+    as->row_of_col = realloc(as->row_of_col, n * sizeof(int));
+    as->pred = realloc(as->pred, n * sizeof(int));
+    as->labeled = realloc(as->labeled, n * sizeof(int));
+    as->settled = realloc(as->settled, n * sizeof(int));
+    as->v = realloc(as->v, n * sizeof(double));
+    as->d = realloc(as->d, n * sizeof(double));
+}
+
+static int row_arcs(assignment_t *as, int i, struct assignment_arc **arcs)
+{
+    int start, end;
+    zarray_get(as->row_start, i, &start);
+    zarray_get(as->row_start, i + 1, &end);
+    *arcs = &((struct assignment_arc *)as->arcs->data)[start];
+    return end - start;
+}
+
+/* relax all arcs of row i, which is reached with reduced path length h */
+static void relax_row(assignment_t *as, int r, int i, double h, double unmatched_cost)
+{
+    struct assignment_arc *arcs;
+    int narcs = row_arcs(as, i, &arcs);
+
+    // k == -1 is the row's private unmatched column
+    for (int k = -1; k < narcs; k++)
+    {
+        int j = (k < 0) ? as->ncols + i : arcs[k].col;
+        double cost = (k < 0) ? unmatched_cost : arcs[k].cost;
+        if (as->settled[j] == r)
+            continue;
+
+        double d = h + cost - as->v[j];
+        if (as->labeled[j] != r || d < as->d[j])
+        {
+            as->labeled[j] = r;
+            as->d[j] = d;
+            as->pred[j] = i;
+            heap_push(as, d, j);
+        }
+    }
+}
+
+/* cost of the arc row i is currently assigned through */
+static double assigned_cost(assignment_t *as, int i, double unmatched_cost)
+{
+    int j = as->col_of_row[i];
+    if (j >= as->ncols)
+        return unmatched_cost;
+
+    struct assignment_arc *arcs;
+    int narcs = row_arcs(as, i, &arcs);
+    for (int k = 0; k < narcs; k++)
+        if (arcs[k].col == j)
+            return arcs[k].cost;
+    return unmatched_cost;
+}
+
+int assignment_solve(assignment_t *as)
+{
+    if (as->nrows == 0)
+        return 0;
+
+    // close the last row
+    int end = zarray_size(as->arcs);
+    add_counted(as, as->row_start, &end);
+
+    ensure_capacity(as);
+
+    // leaving a row unmatched costs more than any augmenting path can save,
+    // so the number of matched rows is maximized first
+    double max_cost = 0;
+    for (int k = 0; k < zarray_size(as->arcs); k++)
+    {
+        struct assignment_arc *arc;
+        zarray_get_volatile(as->arcs, k, &arc);
+        max_cost = fmax(max_cost, fabs(arc->cost));
+    }
+    double unmatched_cost = 2 * (max_cost + 1) * (as->nrows + 1);
+
+    int ncols = as->ncols + as->nrows;
+    for (int j = 0; j < ncols; j++)
+    {
+        as->row_of_col[j] = -1;
+        as->labeled[j] = -1;
+        as->settled[j] = -1;
+        as->v[j] = 0;
+    }
+
+    for (int r = 0; r < as->nrows; r++)
+    {
+        // Dijkstra from row r; d[j] is the reduced length of the alternating
+        // path to column j, which stays non-negative under the potentials v
+        zarray_clear(as->heap);
+        zarray_clear(as->settled_cols);
+        relax_row(as, r, r, 0, unmatched_cost);
+
+        int sink = -1;
+        double min = 0;
+        while (zarray_size(as->heap) > 0)
+        {
+            struct heap_entry e = heap_pop(as->heap);
+            int j = e.col;
+            if (as->settled[j] == r || e.d > as->d[j])
+                continue;
+
+            if (as->row_of_col[j] < 0)
+            {
+                sink = j;
+                min = e.d;
+                break;
+            }
+
+            as->settled[j] = r;
+            add_counted(as, as->settled_cols, &j);
+
+            // continue through the row currently holding column j
+            int i = as->row_of_col[j];
+            relax_row(as, r, i, e.d - (assigned_cost(as, i, unmatched_cost) - as->v[j]),
+                      unmatched_cost);
+        }
+
+        // the row's own unmatched column is always free, so a sink exists
+        for (int k = 0; k < zarray_size(as->settled_cols); k++)
+        {
+            int j;
+            zarray_get(as->settled_cols, k, &j);
+            as->v[j] += as->d[j] - min;
+        }
+
+        // augment along the path back to row r
+        for (int j = sink; ; )
+        {
+            int i = as->pred[j];
+            int prev = (i == r) ? -1 : as->col_of_row[i];
+            as->row_of_col[j] = i;
+            as->col_of_row[i] = j;
+            if (i == r)
+                break;
+            j = prev;
+        }
+    }
+
+    int nmatched = 0;
+    for (int i = 0; i < as->nrows; i++)
+    {
+        if (as->col_of_row[i] >= as->ncols)
+            as->col_of_row[i] = -1;
+        else
+            nmatched++;
+    }
+    return nmatched;
+}
+
+void assignment_destroy(assignment_t *as)
+{
+    if (as == NULL)
+        return;
+
+    zarray_destroy(as->row_start);
+    zarray_destroy(as->arcs);
+    zarray_destroy(as->heap);
+    zarray_destroy(as->settled_cols);
+    free(as->col_of_row);
+    free(as->row_of_col);
+    free(as->pred);
+    free(as->labeled);
+    free(as->settled);
+    free(as->v);
+    free(as->d);
+    free(as);
+}
@@ -0,0 +1,49 @@
+#ifndef _ASSIGNMENT_H_
+#define _ASSIGNMENT_H_
+
+#include "common/zarray.h"
+
+/**
+ * Sparse linear assignment: each row is matched to at most one column and
+ * each column to at most one row, minimizing the total cost of the chosen arcs.
+ * Rows may stay unmatched; matching more rows always wins over a lower cost.
+ *
+ * Solved with shortest augmenting paths (Jonker-Volgenant style), running
+ * Dijkstra over the sparse arcs with column potentials, one row at a time.
+ */
+typedef struct assignment assignment_t;
+struct assignment
+{
+    int nrows;
+    int ncols;
+
+    // arcs of row i are arcs[row_start[i]] ... arcs[row_start[i+1]-1]
+    zarray_t *row_start;
+    zarray_t *arcs;
+
+    // matched column per row (-1 if none), filled in by assignment_solve()
+    int *col_of_row;
+
+    // solver state, sized for ncols + nrows (one private "unmatched" column per row)
+    int capacity;
+    int *row_of_col;
+    int *pred;
+    int *labeled;
+    int *settled;
+    double *v;
+    double *d;
+    zarray_t *heap;
+    zarray_t *settled_cols;
+
+    // times one of the buffers above was reallocated to a larger capacity
+    int grows;
+};
+
+assignment_t *assignment_create();
+void assignment_reset(assignment_t *as, int ncols);
+void assignment_add_row(assignment_t *as);
+void assignment_add_arc(assignment_t *as, int col, double cost);
+int assignment_solve(assignment_t *as);
+void assignment_destroy(assignment_t *as);
+
+#endif
@@ -1,4 +1,8 @@
+#include <stdlib.h>
+#include <inttypes.h>
+
 #include "bit_match.h"
+#include "hamming_scan.h"
 #include "queue_buf.h"
 #include "linked_list.h"
 #include "common/math_util.h"
@@ -7,147 +11,350 @@
 
 // #define DEBUG
 
-#define EVEN_MASK       0xaaaa
-#define ODD_MASK        0x5555
+#define EVEN_MASK       0xaaaaaaaaaaaaaaaaULL
+#define ODD_MASK        0x5555555555555555ULL
+
+static inline uint64_t word_mask(int size)
+{
+    return size >= 64 ? ~0ULL : (1ULL << size) - 1;
+}
+
+static inline uint64_t cyclic_lsl(uint64_t bits, int size)
+{
+    return ((bits << 1) | ((bits >> (size - 1)) & 0x1)) & word_mask(size);
+}
+
+#ifdef DEBUG
+static void print_bits(uint64_t bits, int size)
+{
+    for (int i = size - 1; i >= 0; i--)
+        putchar((bits >> i) & 1 ? '1' : '0');
+}
+#endif
 
-static inline uint16_t cyclic_lsl(uint16_t bits, uint8_t size)
+/** Repeats every bit of `bits`, b31..b0 -> b31b31..b0b0. */
+uint64_t double_bits(uint32_t bits)
 {
-    return (bits << 1) | ((bits >> (size - 1)) & 0x1);
+    uint64_t res = bits;
+    res = (res | (res << 16)) & 0x0000ffff0000ffffULL;
+    res = (res | (res << 8)) & 0x00ff00ff00ff00ffULL;
+    res = (res | (res << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    res = (res | (res << 2)) & 0x3333333333333333ULL;
+    res = (res | (res << 1)) & ODD_MASK;
+    return res | (res << 1);
 }
 
-uint16_t double_bits(uint8_t bits)
+/** Keeps the even-position bits of `bits`, the inverse of double_bits(). */
+uint32_t undouble_bits(uint64_t bits)
 {
-    uint16_t res = 0;
-    for (int i = 0; i < 8; i++)
+    uint64_t res = bits & ODD_MASK;
+    res = (res | (res >> 1)) & 0x3333333333333333ULL;
+    res = (res | (res >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+    res = (res | (res >> 4)) & 0x00ff00ff00ff00ffULL;
+    res = (res | (res >> 8)) & 0x0000ffff0000ffffULL;
+    res = (res | (res >> 16)) & 0x00000000ffffffffULL;
+    return (uint32_t)res;
+}
+
+int hamming_dist(uint64_t a, uint64_t b)
+{
+    return __builtin_popcountll(a ^ b);
+}
+
+uint32_t rotl_bits(uint32_t bits, int r, int width)
+{
+    uint64_t b = bits & word_mask(width);
+    return (uint32_t)(((b << r) | (b >> ((width - r) % width))) & word_mask(width));
+}
+
+/** Smallest of the `width` cyclic rotations, equal for codes that only differ in phase. */
+uint32_t canonical_rotation(uint32_t bits, int width)
+{
+    uint32_t res = rotl_bits(bits, 0, width);
+    for (int r = 1; r < width; r++)
     {
-        res |= ((bits & 0x1) << 1 | (bits & 0x1)) << (2*i);
-        bits >>= 1;
+        uint32_t rot = rotl_bits(bits, r, width);
+        if (rot < res) res = rot;
     }
     return res;
 }
 
-uint8_t undouble_bits(uint16_t bits)
+static int code_index_compare(const void *_a, const void *_b)
+{
+    const glitter_code_index_t *a = _a, *b = _b;
+    return (a->canonical > b->canonical) - (a->canonical < b->canonical);
+}
+
+/**
+ * Adds code `idx` to the matcher. For widths up to CODE_LUT_MAX_WIDTH this records
+ * (idx, r) for every observed sequence that rotation r of `code` is strictly closest
+ * to so far; rotations are tried in order, so an exact phase match keeps r = 0.
+ * Wider codes go into the index sorted by canonical rotation.
+ */
+void code_lut_add(lightanchor_detector_t *ld, uint32_t code, int idx)
 {
-    uint8_t res = 0;
-    for (int i = 0; i < 8; i++)
+    if (ld->code_lut == NULL)
     {
-        res |= ((bits & 0x1) << i);
-        bits >>= 2;
+        glitter_code_index_t entry = { canonical_rotation(code, ld->code_width), idx };
+        zarray_add(ld->code_index, &entry);
+        zarray_sort(ld->code_index, code_index_compare);
+
+        // entry idx*width + r is rotation r of code idx
+        for (int r = 0; r < ld->code_width; r++)
+        {
+            uint32_t rot = rotl_bits(code, r, ld->code_width);
+            zarray_add(ld->code_rotations, &rot);
+        }
+        return;
     }
-    return res;
+
+    int size = 1 << ld->code_width;
+    for (int r = 0; r < ld->code_width; r++)
+    {
+        uint32_t rot = rotl_bits(code, r, ld->code_width);
+        for (int v = 0; v < size; v++)
+        {
+            int dist = hamming_dist(v, rot);
+            if (ld->code_lut[v] < 0 || dist < ld->code_lut_dist[v])
+            {
+                ld->code_lut[v] = idx;
+                ld->code_lut_dist[v] = dist;
+                ld->code_lut_rot[v] = r;
+            }
+        }
+    }
+}
+
+/* either phase of a within max_hamming bit errors of b */
+static int match_even_odd(uint64_t a, uint64_t b, int max_hamming)
+{
+    return hamming_dist(a & EVEN_MASK, b & EVEN_MASK) <= max_hamming ||
+           hamming_dist(a & ODD_MASK, b & ODD_MASK) <= max_hamming;
+}
+
+static int match_lut(lightanchor_detector_t *ld, uint32_t even, uint32_t odd, int *rot)
+{
+    uint32_t v = even;
+    if (ld->code_lut[odd] >= 0 &&
+        (ld->code_lut_dist[odd] < ld->code_lut_dist[even] ||
+         (ld->code_lut_dist[odd] == ld->code_lut_dist[even] && ld->code_lut[odd] < ld->code_lut[even])))
+    {
+        v = odd;
+    }
+
+    if (ld->code_lut[v] < 0 || ld->code_lut_dist[v] > ld->max_hamming)
+        return -1;
+
+    *rot = ld->code_lut_rot[v];
+    return ld->code_lut[v];
+}
+
+/* code whose canonical rotation equals that of seq, -1 if none */
+static int match_index(lightanchor_detector_t *ld, uint32_t seq, int *rot)
+{
+    glitter_code_index_t key = { canonical_rotation(seq, ld->code_width), 0 };
+    glitter_code_index_t *entry = bsearch(&key, ld->code_index->data, zarray_size(ld->code_index),
+                                          sizeof(glitter_code_index_t), code_index_compare);
+    if (entry == NULL)
+        return -1;
+
+    glitter_code_t *code;
+    zarray_get_volatile(ld->codes, entry->idx, &code);
+    for (*rot = 0; rotl_bits(code->code, *rot, ld->code_width) != seq; (*rot)++)
+        ;
+    return entry->idx;
 }
 
-// size_t hamming_dist(size_t a, size_t b)
-// {
-//     size_t c = a ^ b;
-//     unsigned int hamm = 0;
-//     while (c)
-//     {
-//         ++hamm;
-//         c &= (c-1);
-//     }
-//     return hamm;
-// }
+/* every rotation of every code, for wide codes with a Hamming tolerance */
+static int match_scan(lightanchor_detector_t *ld, uint32_t even, uint32_t odd, int *rot)
+{
+    int dist;
+    int k = hamming_scan((const uint32_t *)ld->code_rotations->data, zarray_size(ld->code_rotations),
+                         even, odd, &dist);
+    if (k < 0 || dist > ld->max_hamming)
+        return -1;
+
+    *rot = k % ld->code_width;
+    return k / ld->code_width;
+}
 
-static int match_even_odd(uint16_t a, uint16_t b, uint8_t *match)
+/**
+ * Closest registered code, at any rotation, to either phase of `observed`.
+ * Returns its index into ld->codes and sets *rot, or returns -1 if it is more
+ * than ld->max_hamming bits away.
+ */
+static int match_code(lightanchor_detector_t *ld, uint64_t observed, int *rot)
 {
-    uint16_t a_even = a & EVEN_MASK, a_odd = a & ODD_MASK;
-    uint16_t b_even = b & EVEN_MASK, b_odd = b & ODD_MASK;
+    uint32_t mask = (uint32_t)word_mask(ld->code_width);
+    uint32_t even = undouble_bits(observed >> 1) & mask, odd = undouble_bits(observed) & mask;
+
+    if (ld->code_lut != NULL)
+        return match_lut(ld, even, odd, rot);
+
+    if (ld->max_hamming > 0)
+        return match_scan(ld, even, odd, rot);
 
-    if (a_even == b_even)
+    int odd_rot;
+    int idx = match_index(ld, even, rot);
+    int odd_idx = match_index(ld, odd, &odd_rot);
+    if (odd_idx >= 0 && (idx < 0 || odd_idx < idx))
     {
-        if (match) *match = undouble_bits(b_even >> 1);
-        return 1;
+        idx = odd_idx;
+        *rot = odd_rot;
     }
-    else if (a_odd == b_odd)
+    return idx;
+}
+
+/** @copydoc match_codes */
+void match_codes(lightanchor_detector_t *ld, const uint64_t *words, int n, int32_t *idx, uint8_t *rot)
+{
+    uint32_t mask = (uint32_t)word_mask(ld->code_width);
+
+    // the matcher is the same for every word, so pick it once for the batch
+    if (ld->code_lut == NULL && ld->max_hamming > 0)
     {
-        if (match) *match = undouble_bits(b_odd);
-        return 1;
+        const uint32_t *table = (const uint32_t *)ld->code_rotations->data;
+        int ntable = zarray_size(ld->code_rotations);
+        for (int i = 0; i < n; i++)
+        {
+            int dist;
+            int k = hamming_scan(table, ntable, undouble_bits(words[i] >> 1) & mask,
+                                 undouble_bits(words[i]) & mask, &dist);
+            idx[i] = (k < 0 || dist > ld->max_hamming) ? -1 : k / ld->code_width;
+            rot[i] = (idx[i] < 0) ? 0 : k % ld->code_width;
+        }
+        return;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int r = 0;
+        idx[i] = match_code(ld, words[i], &r);
+        rot[i] = r;
     }
-    else {
-        if (match) *match = 0xff; // invalid
+}
+
+/** @copydoc acquire_state */
+int acquire_state(lightanchor_detector_t *ld, int idx, int rot, uint64_t *next_code,
+                  uint32_t *matched, char *valid)
+{
+    if (idx < 0)
+    {
+        *valid = 0;
         return 0;
     }
+
+    glitter_code_t *code;
+    zarray_get_volatile(ld->codes, idx, &code);
+    uint64_t code_to_match = double_bits(rotl_bits(code->code, rot, ld->code_width));
+
+    // the word keeps the samples as read, so if this match is lost they can be looked up again
+    *matched = code->code;
+    *next_code = cyclic_lsl(code_to_match, 2*ld->code_width);
+    *valid = 1;
+    return 1;
 }
 
-int decode(lightanchor_detector_t *ld, lightanchor_t *candidate_curr)
+/* matches a code state against every phase of every code, and starts tracking at that phase */
+static int acquire(lightanchor_detector_t *ld, uint64_t *code_state, uint64_t *next_code,
+                   uint32_t *matched, char *valid)
 {
+    int rot = 0;
+    int idx = match_code(ld, *code_state, &rot);
 #ifdef DEBUG
-    printf(""BYTE_TO_BINARY_PATTERN""BYTE_TO_BINARY_PATTERN" ",
-            BYTE_TO_BINARY(candidate_curr->code>>8), BYTE_TO_BINARY(candidate_curr->code));
-#endif
-
-    uint16_t code_to_match;
-    if (candidate_curr->valid)
+    if (idx >= 0)
     {
-        code_to_match = candidate_curr->next_code;
-        uint16_t shifted = cyclic_lsl(code_to_match, 16);
-#ifdef DEBUG
-        printf(" "BYTE_TO_BINARY_PATTERN""BYTE_TO_BINARY_PATTERN"\n",
-                BYTE_TO_BINARY(code_to_match>>8), BYTE_TO_BINARY(code_to_match));
+        glitter_code_t *code;
+        zarray_get_volatile(ld->codes, idx, &code);
+        printf("==== MATCH ====\n");
+        print_bits(*code_state, 2*ld->code_width);
+        printf(" == ");
+        print_bits(double_bits(rotl_bits(code->code, rot, ld->code_width)), 2*ld->code_width);
+        printf("\n===============\n");
+    }
 #endif
-        if (match_even_odd(candidate_curr->code, code_to_match, NULL))
-        {
-            candidate_curr->next_code = cyclic_lsl(code_to_match, 16);
-            candidate_curr->valid = 1;
-        }
-        // additional check in case code is matched to shifted version of itself
-        else if (match_even_odd(candidate_curr->code, shifted, NULL))
-        {
-            candidate_curr->next_code = cyclic_lsl(shifted, 16);
-            candidate_curr->valid = 1;
-        }
-        else {
+    return acquire_state(ld, idx, rot, next_code, matched, valid);
+}
+
+/* checks a tracked word against the phase it should be at next, 0 if it lost it */
+static int track(lightanchor_detector_t *ld, uint64_t code, uint64_t *next_code)
+{
+    int size = 2*ld->code_width;
+
+    uint64_t code_to_match = *next_code;
+    uint64_t shifted = cyclic_lsl(code_to_match, size);
 #ifdef DEBUG
-            printf("==== LOST ====\n");
-            printf(""BYTE_TO_BINARY_PATTERN""BYTE_TO_BINARY_PATTERN" != ",
-                    BYTE_TO_BINARY(candidate_curr->code>>8), BYTE_TO_BINARY(candidate_curr->code));
-            printf(""BYTE_TO_BINARY_PATTERN""BYTE_TO_BINARY_PATTERN" | ",
-                    BYTE_TO_BINARY(code_to_match>>8), BYTE_TO_BINARY(code_to_match));
-            printf(""BYTE_TO_BINARY_PATTERN""BYTE_TO_BINARY_PATTERN"\n",
-                    BYTE_TO_BINARY(shifted>>8), BYTE_TO_BINARY(shifted));
-
-            int j = candidate_curr->brightnesses.idx;
-            for (int i = 0; i < BUF_SIZE; i++)
-            {
-                printf("%u ", candidate_curr->brightnesses.buf[j]);
-                j = (j + 1) % BUF_SIZE;
-            }
-            puts("");
-            printf("===============\n");
+    print_bits(code, size);
+    printf(" ");
+    print_bits(code_to_match, size);
+    printf("\n");
 #endif
-            candidate_curr->valid = 0;
-            // candidate_curr->next_code = cyclic_lsl(code_to_match, 16);
-        }
-        return candidate_curr->valid;
+    if (match_even_odd(code, code_to_match, ld->max_hamming))
+    {
+        *next_code = shifted;
+        return 1;
     }
-    else {
-        for (int i = 0; i < zarray_size(ld->codes); i++)
-        {
-            glitter_code_t *code;
-            zarray_get_volatile(ld->codes, i, &code);
-            code_to_match = code->doubled_code;
-#ifdef DEBUG
-            printf(" "BYTE_TO_BINARY_PATTERN""BYTE_TO_BINARY_PATTERN"\n",
-                    BYTE_TO_BINARY(code_to_match>>8), BYTE_TO_BINARY(code_to_match));
-#endif
-            if (match_even_odd(candidate_curr->code, code_to_match, &candidate_curr->match_code))
-            {
+
+    // additional check in case code is matched to shifted version of itself
+    if (match_even_odd(code, shifted, ld->max_hamming))
+    {
+        *next_code = cyclic_lsl(shifted, size);
+        return 1;
+    }
+
 #ifdef DEBUG
-                printf("==== MATCH ====\n");
-                printf(""BYTE_TO_BINARY_PATTERN""BYTE_TO_BINARY_PATTERN" == ",
-                        BYTE_TO_BINARY(candidate_curr->code>>8), BYTE_TO_BINARY(candidate_curr->code));
-                printf(""BYTE_TO_BINARY_PATTERN""BYTE_TO_BINARY_PATTERN"\n",
-                        BYTE_TO_BINARY(code_to_match>>8), BYTE_TO_BINARY(code_to_match));
-                printf("===============\n");
+    printf("==== LOST ====\n");
+    print_bits(code, size);
+    printf(" != ");
+    print_bits(code_to_match, size);
+    printf(" | ");
+    print_bits(shifted, size);
+    printf("\n===============\n");
 #endif
-                candidate_curr->code = code_to_match;
-                candidate_curr->next_code = cyclic_lsl(code_to_match, 16);
-                candidate_curr->valid = 1;
-                return 1;
-            }
-        }
-        candidate_curr->valid = 0;
-        return 0;
-    }
+    return 0;
+}
+
+/** @copydoc decode_state */
+int decode_state(lightanchor_detector_t *ld, uint64_t *code, uint64_t *next_code,
+                 uint32_t *matched, char *valid)
+{
+    // only the last `size` samples are part of the word
+    *code &= word_mask(2*ld->code_width);
+
+    if (*valid && track(ld, *code, next_code))
+        return 1;
+
+    // no phase yet, or lost it: the sequence may still match some code at another one
+    return acquire(ld, code, next_code, matched, valid);
+}
+
+int decode(lightanchor_detector_t *ld, lightanchor_t *candidate_curr)
+{
+    return decode_state(ld, &candidate_curr->code, &candidate_curr->next_code,
+                        &candidate_curr->match_code, &candidate_curr->valid);
+}
+
+/** @copydoc track_sample */
+int track_sample(lightanchor_detector_t *ld, int bit, uint64_t *code, uint64_t *next_code,
+                 char *valid, uint8_t *nbits)
+{
+    int size = 2*ld->code_width;
+
+    *code = ((*code << 1) | (bit != 0)) & word_mask(size);
+
+    if (*nbits < size && ++(*nbits) < size)
+        return -1;
+
+    return *valid && track(ld, *code, next_code);
+}
+
+/** @copydoc decode_sample */
+int decode_sample(lightanchor_detector_t *ld, int bit, uint64_t *code, uint64_t *next_code,
+                  uint32_t *matched, char *valid, uint8_t *nbits)
+{
+    int tracked = track_sample(ld, bit, code, next_code, valid, nbits);
+    if (tracked != 0)
+        return tracked;
+
+    return acquire(ld, code, next_code, matched, valid);
 }
@@ -18,13 +18,77 @@
     (byte & 0x01 ? '1' : '0')
 
 typedef struct {
-    uint8_t code;
-    uint16_t doubled_code;
+    uint32_t code;
+    uint64_t doubled_code;
+    uint32_t canonical;  // canonical_rotation(code, width)
 } glitter_code_t;
 
-uint16_t double_bits(uint8_t bits);
-uint8_t undouble_bits(uint16_t bits);
-// size_t hamming_dist(size_t a, size_t b);
+/* entry of the canonical-rotation index used for codes wider than CODE_LUT_MAX_WIDTH */
+typedef struct {
+    uint32_t canonical;
+    int idx;
+} glitter_code_index_t;
+
+uint64_t double_bits(uint32_t bits);
+uint32_t undouble_bits(uint64_t bits);
+int hamming_dist(uint64_t a, uint64_t b);
+uint32_t rotl_bits(uint32_t bits, int r, int width);
+uint32_t canonical_rotation(uint32_t bits, int width);
+void code_lut_add(lightanchor_detector_t *ld, uint32_t code, int idx);
+
+/**
+ * Batch form of the acquisition lookup in decode(): matches n observed words
+ * (2*code_width samples each) against every phase of every registered code.
+ * idx[i] is the index into ld->codes, -1 if nothing is within ld->max_hamming,
+ * and rot[i] the rotation of that code. Wide codes with a Hamming tolerance are
+ * scanned with hamming_scan(), the others go through the lookup table or index.
+ */
+void match_codes(lightanchor_detector_t *ld, const uint64_t *words, int n, int32_t *idx, uint8_t *rot);
+
+/**
+ * Starts tracking a candidate at the code and rotation match_codes() found for
+ * its word, or marks it invalid if idx is -1. The state is passed as in
+ * decode_state().
+ *
+ * @return 1 if the candidate decoded
+ */
+int acquire_state(lightanchor_detector_t *ld, int idx, int rot, uint64_t *next_code,
+                  uint32_t *matched, char *valid);
+
+/**
+ * Checks the newest word of a candidate against the phase it is tracking, or looks
+ * for a code at any phase if it has none (valid == 0) or lost it. The fields are
+ * those of lightanchor_t, passed separately so rows of a candidate_table_t can be
+ * decoded in place.
+ *
+ * @return 1 if the candidate decoded
+ */
+int decode_state(lightanchor_detector_t *ld, uint64_t *code, uint64_t *next_code,
+                 uint32_t *matched, char *valid);
 int decode(lightanchor_detector_t *ld, lightanchor_t *candidate_curr);
 
+/**
+ * Shifts one sample, nonzero for on, into a candidate's word and decodes it.
+ * A new candidate only looks for a code once it has read a full window: before
+ * that most of the word is zero-fill, which would match whichever code is
+ * nearest. From then on, a lost track is looked up again on every sample. The
+ * state is passed as in decode_state().
+ *
+ * @param *nbits samples read so far, 0 for a new candidate
+ * @return 1 if the candidate decoded, 0 if not, -1 while it reads its first window
+ */
+int decode_sample(lightanchor_detector_t *ld, int bit, uint64_t *code, uint64_t *next_code,
+                  uint32_t *matched, char *valid, uint8_t *nbits);
+
+/**
+ * decode_sample() without the lookup, for decoding many candidates in one batch:
+ * a candidate that is no longer on its tracked phase, or has none, is left for
+ * match_codes() and acquire_state().
+ *
+ * @return 1 if the candidate decoded on its tracked phase, 0 if its word has to
+ *         be looked up, -1 while it reads its first window
+ */
+int track_sample(lightanchor_detector_t *ld, int bit, uint64_t *code, uint64_t *next_code,
+                 char *valid, uint8_t *nbits);
+
 #endif
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/matd.h"
+#include "common/g2d.h"
+
+#include "candidate_table.h"
+
+candidate_table_t *candidate_table_create()
+{
+    return calloc(1, sizeof(candidate_table_t));
+}
+
+void candidate_table_clear(candidate_table_t *t)
+{
+    t->size = 0;
+}
+
+static void grow(candidate_table_t *t)
+{
+    t->capacity = (t->capacity > 0) ? 2*t->capacity : 64;
+    t->grows++;
+    int n = t->capacity;
+
+    t->c = realloc(t->c, n * sizeof(double[2]));
+    t->shape = realloc(t->shape, n * sizeof(double));
+    t->min_dist = realloc(t->min_dist, n * sizeof(double));
+    t->frames = realloc(t->frames, n * sizeof(int));
+    t->code = realloc(t->code, n * sizeof(uint64_t));
+    t->next_code = realloc(t->next_code, n * sizeof(uint64_t));
+    t->match_code = realloc(t->match_code, n * sizeof(uint32_t));
+    t->valid = realloc(t->valid, n * sizeof(char));
+    t->nbits = realloc(t->nbits, n * sizeof(uint8_t));
+    t->brightnesses = realloc(t->brightnesses, n * sizeof(struct queue_buf));
+    t->p = realloc(t->p, n * sizeof(double[4][2]));
+    t->H = realloc(t->H, n * sizeof(double[9]));
+    t->dc = realloc(t->dc, n * sizeof(double[2]));
+    t->id = realloc(t->id, n * sizeof(uint32_t));
+}
+
+static void copy_row(candidate_table_t *t, int i, candidate_table_t *src, int j)
+{
+    memcpy(t->c[i], src->c[j], sizeof(double[2]));
+    t->shape[i] = src->shape[j];
+    t->min_dist[i] = src->min_dist[j];
+    t->frames[i] = src->frames[j];
+    t->code[i] = src->code[j];
+    t->next_code[i] = src->next_code[j];
+    t->match_code[i] = src->match_code[j];
+    t->valid[i] = src->valid[j];
+    t->nbits[i] = src->nbits[j];
+    t->brightnesses[i] = src->brightnesses[j];
+    memcpy(t->p[i], src->p[j], sizeof(double[4][2]));
+    memcpy(t->H[i], src->H[j], sizeof(double[9]));
+    memcpy(t->dc[i], src->dc[j], sizeof(double[2]));
+    t->id[i] = src->id[j];
+}
+
+int candidate_table_add(candidate_table_t *t)
+{
+    if (t->size == t->capacity)
+        grow(t);
+
+    int i = t->size++;
+    memset(t->c[i], 0, sizeof(double[2]));
+    t->shape[i] = 0;
+    t->min_dist[i] = 0;
+    t->frames[i] = 0;
+    t->code[i] = 0;
+    t->next_code[i] = 0;
+    t->match_code[i] = 0;
+    t->valid[i] = 0;
+    t->nbits[i] = 0;
+    memset(&t->brightnesses[i], 0, sizeof(struct queue_buf));
+    memset(t->p[i], 0, sizeof(double[4][2]));
+    memset(t->H[i], 0, sizeof(double[9]));
+    memset(t->dc[i], 0, sizeof(double[2]));
+    t->id[i] = 0;
+    return i;
+}
+
+int candidate_table_add_quad(candidate_table_t *t, struct quad *quad)
+{
+    if (quad->H == NULL)
+        return -1;
+
+    int i = candidate_table_add(t);
+    for (int k = 0; k < 4; k++)
+    {
+        t->p[i][k][0] = quad->p[k][0];
+        t->p[i][k][1] = quad->p[k][1];
+    }
+
+    double *H = t->H[i];
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            H[3*r + c] = MATD_EL(quad->H, r, c);
+
+    // project the tag's origin
+    t->c[i][0] = H[2] / H[8];
+    t->c[i][1] = H[5] / H[8];
+
+    // not scale invariant!
+    t->shape[i] = (g2d_distance(t->p[i][0], t->c[i]) +
+                   g2d_distance(t->p[i][1], t->c[i]) +
+                   g2d_distance(t->p[i][2], t->c[i]) +
+                   g2d_distance(t->p[i][3], t->c[i])) / 4;
+    return i;
+}
+
+int candidate_table_append(candidate_table_t *t, candidate_table_t *src, int j)
+{
+    if (t->size == t->capacity)
+        grow(t);
+
+    int i = t->size++;
+    copy_row(t, i, src, j);
+    return i;
+}
+
+void candidate_table_update(candidate_table_t *t, int i, candidate_table_t *src, int j)
+{
+    t->dc[i][0] = t->c[i][0] - src->c[j][0];
+    t->dc[i][1] = t->c[i][1] - src->c[j][1];
+
+    t->valid[i] = src->valid[j];
+    t->frames[i] = src->frames[j];
+    t->match_code[i] = src->match_code[j];
+    t->code[i] = src->code[j];
+    t->next_code[i] = src->next_code[j];
+    t->nbits[i] = src->nbits[j];
+    t->id[i] = src->id[j];
+
+    qb_copy(&t->brightnesses[i], &src->brightnesses[j]);
+}
+
+void candidate_table_remove(candidate_table_t *t, int i)
+{
+    int last = --t->size;
+    if (i != last)
+        copy_row(t, i, t, last);
+}
+
+void candidate_table_get(candidate_table_t *t, int i, lightanchor_t *la)
+{
+    la->valid = t->valid[i];
+    la->match_code = t->match_code[i];
+    la->code = t->code[i];
+    la->next_code = t->next_code[i];
+    la->nbits = t->nbits[i];
+    la->frames = t->frames[i];
+    la->min_dist = t->min_dist[i];
+    memcpy(la->H, t->H[i], sizeof(double[9]));
+    memcpy(la->c, t->c[i], sizeof(double[2]));
+    memcpy(la->p, t->p[i], sizeof(double[4][2]));
+    memcpy(la->dc, t->dc[i], sizeof(double[2]));
+    la->shape = t->shape[i];
+    la->brightnesses = t->brightnesses[i];
+    la->id = t->id[i];
+}
+
+void candidate_table_destroy(candidate_table_t *t)
+{
+    if (t == NULL)
+        return;
+
+    free(t->c);
+    free(t->shape);
+    free(t->min_dist);
+    free(t->frames);
+    free(t->code);
+    free(t->next_code);
+    free(t->match_code);
+    free(t->valid);
+    free(t->nbits);
+    free(t->brightnesses);
+    free(t->p);
+    free(t->H);
+    free(t->dc);
+    free(t->id);
+    free(t);
+}
@@ -0,0 +1,79 @@
+#ifndef _CANDIDATE_TABLE_H_
+#define _CANDIDATE_TABLE_H_
+
+#include <stdint.h>
+
+#include "apriltag.h"
+#include "queue_buf.h"
+#include "lightanchor.h"
+
+/**
+ * Candidates stored as a structure of arrays, one row per candidate.
+ * Association only walks the centers and shapes, decoding the code state and
+ * brightness windows, so each pass streams through the arrays it needs instead
+ * of pulling whole lightanchor_t structs through the cache.
+ *
+ * Rows are plain indices and move when a row is removed (the last row takes
+ * its place). id stays with the candidate and is what callers should hold on to.
+ */
+typedef struct candidate_table candidate_table_t;
+struct candidate_table
+{
+    int size;
+    int capacity;
+
+    // times the arrays were reallocated to a larger capacity
+    int grows;
+
+    // read by association every frame
+    double (*c)[2];
+    double *shape;
+    double *min_dist;
+    int *frames;
+
+    // code state, see decode_state()
+    uint64_t *code;
+    uint64_t *next_code;
+    uint32_t *match_code;
+    char *valid;
+    // samples shifted into code so far, counting up to a full window, see decode_sample()
+    uint8_t *nbits;
+
+    struct queue_buf *brightnesses;
+
+    // corners, homography and motion of the center since the previous frame
+    double (*p)[4][2];
+    double (*H)[9];
+    double (*dc)[2];
+
+    // track id, follows the candidate across frames, 0 while it is not decoded
+    uint32_t *id;
+};
+
+candidate_table_t *candidate_table_create();
+void candidate_table_clear(candidate_table_t *t);
+
+/** Appends a zeroed row and returns its index. */
+int candidate_table_add(candidate_table_t *t);
+
+/**
+ * Appends a row for a quad: corners, homography, projected center and shape.
+ * Returns its index, or -1 if the quad has no homography.
+ */
+int candidate_table_add_quad(candidate_table_t *t, struct quad *quad);
+
+/** Appends a copy of row j of src and returns its index. */
+int candidate_table_append(candidate_table_t *t, candidate_table_t *src, int j);
+
+/** Row i of t continues row j of src, same as lightanchor_update(). */
+void candidate_table_update(candidate_table_t *t, int i, candidate_table_t *src, int j);
+
+/** Removes row i, the last row moves into its place. */
+void candidate_table_remove(candidate_table_t *t, int i);
+
+/** Copies row i into a lightanchor_t. */
+void candidate_table_get(candidate_table_t *t, int i, lightanchor_t *la);
+
+void candidate_table_destroy(candidate_table_t *t);
+
+#endif
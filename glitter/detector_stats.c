@@ -0,0 +1,29 @@
+#include "detector_stats.h"
+
+static const char *stage_names[STAGE_COUNT] = {
+    "quad_thresh",
+    "refine_edges",
+    "homography",
+    "association",
+    "brightness",
+    "decode",
+};
+
+static const char *counter_names[COUNTER_COUNT] = {
+    "quads",
+    "candidates",
+    "ttl_carries",
+    "decode_hits",
+    "decode_misses",
+    "allocations",
+};
+
+const char *detector_stage_name(int stage)
+{
+    return (stage >= 0 && stage < STAGE_COUNT) ? stage_names[stage] : "unknown";
+}
+
+const char *detector_counter_name(int counter)
+{
+    return (counter >= 0 && counter < COUNTER_COUNT) ? counter_names[counter] : "unknown";
+}
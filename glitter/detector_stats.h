@@ -0,0 +1,66 @@
+#ifndef _DETECTOR_STATS_H_
+#define _DETECTOR_STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* stages timed by the detector */
+enum detector_stage
+{
+    // detect_quads_tracked(): region prediction, copying the frame and apriltag_quad_thresh()
+    STAGE_QUAD_THRESH = 0,
+    STAGE_REFINE_EDGES,
+    STAGE_HOMOGRAPHY,
+    // matching candidates to the new quads and finding lost tracks
+    STAGE_ASSOCIATION,
+    // sampling candidate brightness, and building the integral image when it is used
+    STAGE_BRIGHTNESS,
+    STAGE_DECODE,
+    STAGE_COUNT,
+};
+
+/* events counted by the detector */
+enum detector_counter
+{
+    // quads passed to decode_tags()
+    COUNTER_QUADS = 0,
+    // candidates tracked after each frame
+    COUNTER_CANDIDATES,
+    // unmatched candidates carried over on their ttl
+    COUNTER_TTL_CARRIES,
+    // candidates with a full brightness window that decoded, or did not
+    COUNTER_DECODE_HITS,
+    COUNTER_DECODE_MISSES,
+    // heap allocations of the detector's own buffers, what ld->nallocs counts
+    COUNTER_ALLOCATIONS,
+    COUNTER_COUNT,
+};
+
+/**
+ * Timings and counters summed over the frames since the last reset.
+ * Stages that run on worker threads (edge refinement, homography, brightness
+ * and decode) are summed over the threads, so they can add up to more than
+ * the wall time of a frame.
+ */
+typedef struct detector_stats detector_stats_t;
+struct detector_stats
+{
+    uint64_t frames;
+
+    // nanoseconds, CLOCK_MONOTONIC
+    uint64_t ns[STAGE_COUNT];
+
+    uint64_t counters[COUNTER_COUNT];
+};
+
+const char *detector_stage_name(int stage);
+const char *detector_counter_name(int counter);
+
+static inline uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
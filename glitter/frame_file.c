@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame_file.h"
+
+// offsets of the header fields
+#define HEADER_VERSION  8
+#define HEADER_WIDTH    12
+#define HEADER_HEIGHT   16
+#define HEADER_STRIDE   20
+
+static const uint8_t zeros[FRAME_FILE_ALIGN];
+
+static size_t align_up(size_t n)
+{
+    return (n + FRAME_FILE_ALIGN - 1) / FRAME_FILE_ALIGN * FRAME_FILE_ALIGN;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (8*i);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_i64(uint8_t *p, int64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint64_t)v >> (8*i);
+}
+
+static int64_t get_i64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return (int64_t)v;
+}
+
+frame_file_t *frame_file_create(const char *path, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return NULL;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return NULL;
+
+    frame_file_t *ff = calloc(1, sizeof(frame_file_t));
+    ff->width = width;
+    ff->height = height;
+    // aligned rows, so views of the file are as fast to scan as image_u8_create() images
+    ff->stride = align_up(width);
+    ff->record_size = FRAME_FILE_ALIGN + align_up((size_t)ff->stride * height);
+    ff->f = f;
+
+    uint8_t header[FRAME_FILE_ALIGN] = { 0 };
+    memcpy(header, FRAME_FILE_MAGIC, 8);
+    put_u32(&header[HEADER_VERSION], FRAME_FILE_VERSION);
+    put_u32(&header[HEADER_WIDTH], width);
+    put_u32(&header[HEADER_HEIGHT], height);
+    put_u32(&header[HEADER_STRIDE], ff->stride);
+    if (fwrite(header, sizeof(header), 1, f) != 1)
+    {
+        frame_file_destroy(ff);
+        return NULL;
+    }
+
+    return ff;
+}
+
+int frame_file_write(frame_file_t *ff, const image_u8_t *im, int64_t utime)
+{
+    if (ff->f == NULL || im->width != ff->width || im->height != ff->height)
+        return -1;
+
+    uint8_t header[FRAME_FILE_ALIGN] = { 0 };
+    put_i64(header, utime);
+    if (fwrite(header, sizeof(header), 1, ff->f) != 1)
+        return -1;
+
+    for (int y = 0; y < im->height; y++)
+    {
+        if (fwrite(&im->buf[y*im->stride], 1, im->width, ff->f) != (size_t)im->width ||
+            fwrite(zeros, 1, ff->stride - im->width, ff->f) != (size_t)(ff->stride - im->width))
+            return -1;
+    }
+
+    size_t pad = ff->record_size - FRAME_FILE_ALIGN - (size_t)ff->stride * ff->height;
+    if (fwrite(zeros, 1, pad, ff->f) != pad)
+        return -1;
+
+    ff->nframes++;
+    return 0;
+}
+
+frame_file_t *frame_file_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < FRAME_FILE_ALIGN)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // the mapping holds its own reference to the file; it is private, so
+    // anything that draws into a frame gets its own copy of the pages
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    frame_file_t *ff = calloc(1, sizeof(frame_file_t));
+    ff->map = map;
+    ff->map_size = st.st_size;
+
+    if (memcmp(map, FRAME_FILE_MAGIC, 8) || get_u32(&map[HEADER_VERSION]) != FRAME_FILE_VERSION)
+    {
+        frame_file_destroy(ff);
+        return NULL;
+    }
+
+    ff->width = get_u32(&map[HEADER_WIDTH]);
+    ff->height = get_u32(&map[HEADER_HEIGHT]);
+    ff->stride = get_u32(&map[HEADER_STRIDE]);
+    if (ff->width <= 0 || ff->height <= 0 || ff->stride < ff->width)
+    {
+        frame_file_destroy(ff);
+        return NULL;
+    }
+
+    ff->record_size = FRAME_FILE_ALIGN + align_up((size_t)ff->stride * ff->height);
+    ff->nframes = (ff->map_size - FRAME_FILE_ALIGN) / ff->record_size;
+
+#ifdef MADV_SEQUENTIAL
+    // replays read front to back, so pages can be dropped once they are behind
+    madvise(map, ff->map_size, MADV_SEQUENTIAL);
+#endif
+
+    return ff;
+}
+
+image_u8_t frame_file_get(frame_file_t *ff, int i, int64_t *utime)
+{
+    if (ff->map == NULL || i < 0 || i >= ff->nframes)
+    {
+        image_u8_t none = { .width = 0, .height = 0, .stride = 0, .buf = NULL };
+        return none;
+    }
+
+    uint8_t *record = ff->map + FRAME_FILE_ALIGN + i * ff->record_size;
+    if (utime)
+        *utime = get_i64(record);
+
+    image_u8_t im = {
+        .width = ff->width,
+        .height = ff->height,
+        .stride = ff->stride,
+        .buf = record + FRAME_FILE_ALIGN
+    };
+
+#ifdef MADV_WILLNEED
+    if (i + 1 < ff->nframes)
+    {
+        // madvise() wants a page-aligned start
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t start = (FRAME_FILE_ALIGN + (i + 1) * ff->record_size) / page * page;
+        size_t len = ff->record_size + page;
+        if (start + len > ff->map_size)
+            len = ff->map_size - start;
+        madvise(ff->map + start, len, MADV_WILLNEED);
+    }
+#endif
+
+    return im;
+}
+
+void frame_file_destroy(frame_file_t *ff)
+{
+    if (ff == NULL)
+        return;
+
+    if (ff->f)
+        fclose(ff->f);
+    if (ff->map)
+        munmap(ff->map, ff->map_size);
+    free(ff);
+}
@@ -0,0 +1,79 @@
+#ifndef _FRAME_FILE_H_
+#define _FRAME_FILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "apriltag.h"
+
+#define FRAME_FILE_MAGIC        "GLTFRM01"
+#define FRAME_FILE_VERSION      1
+
+// header and records are multiples of this, so every frame starts aligned
+#define FRAME_FILE_ALIGN        64
+
+/**
+ * Recorded camera session: a header followed by fixed-size records of one
+ * grayscale frame each, readable back without decoding or copying.
+ *
+ * The header is FRAME_FILE_ALIGN bytes: the 8-byte magic, then uint32
+ * version, width, height and stride, little-endian, and zero padding. A
+ * record is an int64 timestamp in microseconds, zero padding up to
+ * FRAME_FILE_ALIGN, and the frame as height rows of stride bytes, padded to a
+ * multiple of FRAME_FILE_ALIGN. The number of frames follows from the file
+ * size, so a recording that was cut short is still readable up to its last
+ * complete frame.
+ */
+typedef struct frame_file frame_file_t;
+struct frame_file
+{
+    int width;
+    int height;
+    // bytes from one row to the next, in the file and in the views
+    int stride;
+
+    int nframes;
+    size_t record_size;
+
+    // set when writing
+    FILE *f;
+
+    // set when reading: the whole file, mapped copy-on-write
+    uint8_t *map;
+    size_t map_size;
+};
+
+/**
+ * Start a recording of width by height frames at path, replacing any file
+ * there. Returns NULL if the file cannot be written.
+ */
+frame_file_t *frame_file_create(const char *path, int width, int height);
+
+/**
+ * Append a frame of the size given to frame_file_create(), with any stride.
+ * Returns 0 on success, -1 on a size mismatch or a failed write.
+ */
+int frame_file_write(frame_file_t *ff, const image_u8_t *im, int64_t utime);
+
+/**
+ * Map a recording for reading. Returns NULL if path cannot be mapped or is
+ * not a recording.
+ */
+frame_file_t *frame_file_open(const char *path);
+
+/**
+ * View of frame i of a mapped recording. The pixels are not copied and stay
+ * valid until frame_file_destroy(). Writing to them only changes this
+ * process's copy of the pages, the file is never modified. Also asks the
+ * kernel to start reading frame i + 1.
+ *
+ * @param *utime where to store the frame's timestamp, may be NULL
+ *
+ * @return image header pointing into the file, with a NULL buf if i is out of range
+ */
+image_u8_t frame_file_get(frame_file_t *ff, int i, int64_t *utime);
+
+/** Close a recording, flushing it if it was being written. */
+void frame_file_destroy(frame_file_t *ff);
+
+#endif
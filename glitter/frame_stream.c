@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "common/time_util.h"
+
+#include "frame_stream.h"
+
+#define Y4M_MAGIC       "YUV4MPEG2"
+#define Y4M_FRAME       "FRAME"
+// longest stream header or frame header line accepted
+#define Y4M_LINE_MAX    1024
+
+/* read() retried on interrupts, 0 at EOF, -1 on errors */
+static ssize_t read_some(int fd, void *buf, size_t n)
+{
+    for (;;)
+    {
+        // the only place the reader thread can be cancelled
+        int state;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+        ssize_t r = read(fd, buf, n);
+        pthread_setcancelstate(state, NULL);
+
+        if (r >= 0 || errno != EINTR)
+            return r;
+    }
+}
+
+static int fill(frame_stream_t *fs)
+{
+    ssize_t r = read_some(fs->fd, fs->in, FRAME_STREAM_INPUT_SIZE);
+    if (r <= 0)
+        return r < 0 ? -1 : 0;
+
+    fs->in_pos = 0;
+    fs->in_len = r;
+    return 1;
+}
+
+/* exactly n bytes into dst, what is not buffered already is read straight into dst */
+static int read_bytes(frame_stream_t *fs, uint8_t *dst, size_t n)
+{
+    size_t buffered = fs->in_len - fs->in_pos;
+    if (buffered > n)
+        buffered = n;
+    memcpy(dst, &fs->in[fs->in_pos], buffered);
+    fs->in_pos += buffered;
+
+    for (size_t got = buffered; got < n; )
+    {
+        ssize_t r = read_some(fs->fd, &dst[got], n - got);
+        if (r <= 0)
+            return -1;
+        got += r;
+    }
+    return 0;
+}
+
+static int skip_bytes(frame_stream_t *fs, int64_t n)
+{
+    while (n > 0)
+    {
+        if (fs->in_pos == fs->in_len && fill(fs) <= 0)
+            return -1;
+
+        int64_t k = fs->in_len - fs->in_pos;
+        if (k > n)
+            k = n;
+        fs->in_pos += k;
+        n -= k;
+    }
+    return 0;
+}
+
+/* one line without its newline; 0 if the stream ended cleanly before it, -1 on errors */
+static int read_line(frame_stream_t *fs, char *line, int max)
+{
+    int n = 0;
+    for (;;)
+    {
+        if (fs->in_pos == fs->in_len)
+        {
+            int r = fill(fs);
+            if (r <= 0)
+                return (r == 0 && n == 0) ? 0 : -1;
+        }
+
+        char c = fs->in[fs->in_pos++];
+        if (c == '\n')
+            break;
+        if (n == max - 1)
+            return -1;
+        line[n++] = c;
+    }
+    line[n] = 0;
+    return 1;
+}
+
+/* bytes of chroma per frame for a Y4M colorspace tag, -1 for anything but 8-bit formats */
+static int64_t y4m_chroma_size(const char *tag, int width, int height)
+{
+    int64_t cw = (width + 1) / 2, ch = (height + 1) / 2;
+
+    if (!strcmp(tag, "420") || !strcmp(tag, "420jpeg") || !strcmp(tag, "420mpeg2") ||
+        !strcmp(tag, "420paldv"))
+        return 2 * cw * ch;
+    if (!strcmp(tag, "422"))
+        return 2 * cw * height;
+    if (!strcmp(tag, "411"))
+        return 2 * (int64_t)((width + 3) / 4) * height;
+    if (!strcmp(tag, "444"))
+        return 2 * (int64_t)width * height;
+    if (!strcmp(tag, "444alpha"))
+        return 3 * (int64_t)width * height;
+    if (!strcmp(tag, "mono"))
+        return 0;
+    return -1;
+}
+
+static int parse_y4m_header(frame_stream_t *fs)
+{
+    char line[Y4M_LINE_MAX];
+    if (read_line(fs, line, sizeof(line)) <= 0 || strncmp(line, Y4M_MAGIC " ", strlen(Y4M_MAGIC) + 1))
+        return -1;
+
+    char colorspace[32] = "420";
+    char *save;
+    for (char *tok = strtok_r(line + strlen(Y4M_MAGIC), " ", &save); tok; tok = strtok_r(NULL, " ", &save))
+    {
+        switch (tok[0])
+        {
+            case 'W':
+                fs->width = atoi(tok + 1);
+                break;
+            case 'H':
+                fs->height = atoi(tok + 1);
+                break;
+            case 'F':
+                if (sscanf(tok + 1, "%d:%d", &fs->fps_num, &fs->fps_den) != 2)
+                    fs->fps_num = fs->fps_den = 0;
+                break;
+            case 'C':
+                snprintf(colorspace, sizeof(colorspace), "%s", tok + 1);
+                break;
+        }
+    }
+
+    if (fs->width <= 0 || fs->height <= 0)
+        return -1;
+
+    fs->chroma_size = y4m_chroma_size(colorspace, fs->width, fs->height);
+    return fs->chroma_size < 0 ? -1 : 0;
+}
+
+/* 1 with the next frame in im, 0 at a clean end of stream, -1 on errors */
+static int read_frame(frame_stream_t *fs, image_u8_t *im)
+{
+    if (fs->chroma_size >= 0)
+    {
+        char line[Y4M_LINE_MAX];
+        int r = read_line(fs, line, sizeof(line));
+        if (r <= 0)
+            return r;
+        if (strncmp(line, Y4M_FRAME, strlen(Y4M_FRAME)))
+            return -1;
+    }
+    else if (fs->in_pos == fs->in_len)
+    {
+        // a raw stream may only end between frames
+        int r = fill(fs);
+        if (r <= 0)
+            return r;
+    }
+
+    if (fs->plane == NULL)
+    {
+        if (read_bytes(fs, im->buf, (size_t)im->width * im->height))
+            return -1;
+    }
+    else {
+        // padded rows are copied out of the plane, which is read in as few calls as for unpadded ones
+        if (read_bytes(fs, fs->plane, (size_t)im->width * im->height))
+            return -1;
+        for (int y = 0; y < im->height; y++)
+            memcpy(&im->buf[y*im->stride], &fs->plane[(size_t)y*im->width], im->width);
+    }
+
+    if (fs->chroma_size > 0 && skip_bytes(fs, fs->chroma_size))
+        return -1;
+
+    return 1;
+}
+
+static void *reader_thread(void *_u)
+{
+    frame_stream_t *fs = (frame_stream_t *)_u;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for (int slot = 0; ; slot ^= 1)
+    {
+        pthread_mutex_lock(&fs->mutex);
+        while (fs->full[slot] && !fs->stop)
+            pthread_cond_wait(&fs->cond, &fs->mutex);
+        int stop = fs->stop;
+        pthread_mutex_unlock(&fs->mutex);
+        if (stop)
+            break;
+
+        int r = read_frame(fs, fs->frames[slot]);
+
+        pthread_mutex_lock(&fs->mutex);
+        if (r > 0)
+        {
+            fs->full[slot] = 1;
+        }
+        else {
+            fs->eof = 1;
+            fs->error = r < 0;
+        }
+        pthread_cond_broadcast(&fs->cond);
+        pthread_mutex_unlock(&fs->mutex);
+
+        if (r <= 0)
+            break;
+    }
+
+    return NULL;
+}
+
+static frame_stream_t *stream_create(int fd)
+{
+    frame_stream_t *fs = calloc(1, sizeof(frame_stream_t));
+    fs->fd = fd;
+    fs->in = malloc(FRAME_STREAM_INPUT_SIZE);
+    fs->held = -1;
+    return fs;
+}
+
+static frame_stream_t *stream_start(frame_stream_t *fs)
+{
+    for (int i = 0; i < 2; i++)
+        fs->frames[i] = image_u8_create(fs->width, fs->height);
+    if (fs->frames[0]->stride != fs->width)
+        fs->plane = malloc((size_t)fs->width * fs->height);
+
+    pthread_mutex_init(&fs->mutex, NULL);
+    pthread_cond_init(&fs->cond, NULL);
+    fs->started = pthread_create(&fs->thread, NULL, reader_thread, fs) == 0;
+
+    // without a thread there is nothing to read the frames
+    if (!fs->started)
+        fs->eof = fs->error = 1;
+    return fs;
+}
+
+frame_stream_t *frame_stream_create_y4m(int fd)
+{
+    frame_stream_t *fs = stream_create(fd);
+    if (parse_y4m_header(fs))
+    {
+        free(fs->in);
+        free(fs);
+        return NULL;
+    }
+    return stream_start(fs);
+}
+
+frame_stream_t *frame_stream_create_raw(int fd, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return NULL;
+
+    frame_stream_t *fs = stream_create(fd);
+    fs->width = width;
+    fs->height = height;
+    fs->chroma_size = -1;
+    return stream_start(fs);
+}
+
+image_u8_t *frame_stream_next(frame_stream_t *fs)
+{
+    int64_t t0 = utime_now();
+
+    pthread_mutex_lock(&fs->mutex);
+    if (fs->held >= 0)
+    {
+        fs->full[fs->held] = 0;
+        fs->held = -1;
+        pthread_cond_broadcast(&fs->cond);
+    }
+
+    // frames read before the end of the stream are still handed out
+    int slot = fs->next;
+    while (!fs->full[slot] && !fs->eof)
+        pthread_cond_wait(&fs->cond, &fs->mutex);
+
+    image_u8_t *im = NULL;
+    if (fs->full[slot])
+    {
+        fs->held = slot;
+        fs->next ^= 1;
+        fs->nframes++;
+        im = fs->frames[slot];
+    }
+    pthread_mutex_unlock(&fs->mutex);
+
+    fs->wait_us += utime_now() - t0;
+    return im;
+}
+
+void frame_stream_destroy(frame_stream_t *fs)
+{
+    if (fs == NULL)
+        return;
+
+    if (fs->started)
+    {
+        pthread_mutex_lock(&fs->mutex);
+        fs->stop = 1;
+        pthread_cond_broadcast(&fs->cond);
+        pthread_mutex_unlock(&fs->mutex);
+
+        // a reader blocked on an idle pipe only returns once it is cancelled
+        pthread_cancel(fs->thread);
+        pthread_join(fs->thread, NULL);
+    }
+
+    pthread_mutex_destroy(&fs->mutex);
+    pthread_cond_destroy(&fs->cond);
+    for (int i = 0; i < 2; i++)
+        image_u8_destroy(fs->frames[i]);
+    free(fs->plane);
+    free(fs->in);
+    free(fs);
+}
@@ -0,0 +1,87 @@
+#ifndef _FRAME_STREAM_H_
+#define _FRAME_STREAM_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "apriltag.h"
+
+// bytes read from the input at a time, headers and short frames are served from here
+#define FRAME_STREAM_INPUT_SIZE 65536
+
+/**
+ * Gray frames read from a pipe, FIFO or file as they arrive, e.g. from
+ * `ffmpeg ... -f yuv4mpegpipe -` or `ffmpeg ... -f rawvideo -pix_fmt gray -`.
+ *
+ * Y4M streams keep their luma plane and skip the chroma planes; raw streams
+ * are width * height bytes per frame. A thread reads the next frame into one
+ * of two buffers while the caller works on the other, so reading overlaps
+ * with detection. Both buffers, and a plane-sized staging buffer when their rows
+ * are padded, are allocated up front and reused, nothing is allocated per frame.
+ */
+typedef struct frame_stream frame_stream_t;
+struct frame_stream
+{
+    int width;
+    int height;
+
+    // Y4M frame rate, 0/0 for raw streams or when the header has none
+    int fps_num, fps_den;
+
+    // frames handed out by frame_stream_next()
+    int nframes;
+
+    // microseconds frame_stream_next() spent waiting on the input
+    int64_t wait_us;
+
+    // set when the stream ended on a read error or a malformed frame rather than at EOF
+    int error;
+
+    // private
+
+    int fd;
+    // bytes of chroma to skip after each Y4M luma plane, -1 for raw streams
+    int64_t chroma_size;
+
+    uint8_t *in;
+    int in_pos, in_len;
+
+    // one luma plane, read whole and copied row by row into frames with padded strides
+    uint8_t *plane;
+
+    image_u8_t *frames[2];
+    int full[2];
+    // slot handed out last, -1 if none; next slot to hand out
+    int held, next;
+    int eof;
+    int stop;
+
+    int started;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/**
+ * Read a Y4M stream from fd. Only 8-bit formats are supported. Returns NULL
+ * if the stream header cannot be read or parsed.
+ */
+frame_stream_t *frame_stream_create_y4m(int fd);
+
+/** Read width by height gray frames, one byte per pixel, from fd. */
+frame_stream_t *frame_stream_create_raw(int fd, int width, int height);
+
+/**
+ * Wait for the next frame. The returned image belongs to the stream and stays
+ * valid until the next call, which hands its buffer back to the reader, so
+ * it can be passed to detect_quads_tracked() and decode_tags() in between.
+ *
+ * @return the frame, or NULL at the end of the stream; check fs->error
+ *         to tell a read error from EOF
+ */
+image_u8_t *frame_stream_next(frame_stream_t *fs);
+
+/** Stop reading, even mid-frame, and free the stream. Does not close fd. */
+void frame_stream_destroy(frame_stream_t *fs);
+
+#endif
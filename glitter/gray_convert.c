@@ -0,0 +1,237 @@
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#include "gray_convert.h"
+
+int gray_decimated_size(int size, int decimate)
+{
+    return 1 + (size - 1) / decimate;
+}
+
+static inline uint8_t luma(const uint8_t *px)
+{
+    return (77*px[0] + 150*px[1] + 29*px[2] + 128) >> 8;
+}
+
+/* output pixels x..n of a row, src is the first input pixel of the row */
+static void convert_tail(const uint8_t *src, int x, int n, int channels, int mode, int decimate, uint8_t *dst)
+{
+    int step = channels * decimate;
+    if (mode == GRAY_LUMA && channels >= 3)
+    {
+        for (; x < n; x++)
+            dst[x] = luma(&src[x*step]);
+    }
+    else {
+        for (; x < n; x++)
+            dst[x] = src[x*step];
+    }
+}
+
+#if defined(__SSE2__)
+
+/* 4 pixels, one per 32-bit lane, starting at src */
+static inline __m128i load_pixels(const uint8_t *src, int decimate)
+{
+    if (decimate == 1)
+        return _mm_loadu_si128((const __m128i *)src);
+
+    __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)src));
+    __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + 16)));
+    return _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+/* gray values of 8 pixels as 16-bit lanes */
+static inline __m128i gray_epi16(__m128i p0, __m128i p1, int mode)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i r = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+    if (mode != GRAY_LUMA)
+        return r;
+
+    __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                                _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+    __m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                                _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+
+    // the weights add up to 256, so the sums fit unsigned 16-bit lanes
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(29)));
+    y = _mm_add_epi16(y, _mm_set1_epi16(128));
+    return _mm_srli_epi16(y, 8);
+}
+
+/* converts 16 output pixels at a time, returns how many were done */
+static int convert_simd(const uint8_t *src, int width, int mode, int decimate, uint8_t *dst)
+{
+    int x = 0;
+    for (; (x + 16) * decimate <= width; x += 16)
+    {
+        const uint8_t *s = &src[4*x*decimate];
+        int step = 16*decimate;
+        __m128i lo = gray_epi16(load_pixels(s, decimate), load_pixels(s + step, decimate), mode);
+        __m128i hi = gray_epi16(load_pixels(s + 2*step, decimate), load_pixels(s + 3*step, decimate), mode);
+        _mm_storeu_si128((__m128i *)&dst[x], _mm_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+const char *gray_convert_isa()
+{
+    return "sse2";
+}
+
+#elif defined(__ARM_NEON)
+
+static inline uint32x4_t load_pixels(const uint8_t *src, int decimate)
+{
+    uint32x4_t a = vreinterpretq_u32_u8(vld1q_u8(src));
+    if (decimate == 1)
+        return a;
+
+    uint32x4_t b = vreinterpretq_u32_u8(vld1q_u8(src + 16));
+    return vuzpq_u32(a, b).val[0];
+}
+
+static inline uint16x8_t gray_u16(uint32x4_t p0, uint32x4_t p1, int mode)
+{
+    const uint32x4_t mask = vdupq_n_u32(0xff);
+    uint16x8_t r = vcombine_u16(vmovn_u32(vandq_u32(p0, mask)), vmovn_u32(vandq_u32(p1, mask)));
+    if (mode != GRAY_LUMA)
+        return r;
+
+    uint16x8_t g = vcombine_u16(vmovn_u32(vandq_u32(vshrq_n_u32(p0, 8), mask)),
+                                vmovn_u32(vandq_u32(vshrq_n_u32(p1, 8), mask)));
+    uint16x8_t b = vcombine_u16(vmovn_u32(vandq_u32(vshrq_n_u32(p0, 16), mask)),
+                                vmovn_u32(vandq_u32(vshrq_n_u32(p1, 16), mask)));
+
+    // the weights add up to 256, so the sums fit unsigned 16-bit lanes
+    uint16x8_t y = vmulq_n_u16(r, 77);
+    y = vmlaq_n_u16(y, g, 150);
+    y = vmlaq_n_u16(y, b, 29);
+    y = vaddq_u16(y, vdupq_n_u16(128));
+    return vshrq_n_u16(y, 8);
+}
+
+static int convert_simd(const uint8_t *src, int width, int mode, int decimate, uint8_t *dst)
+{
+    int x = 0;
+    for (; (x + 16) * decimate <= width; x += 16)
+    {
+        const uint8_t *s = &src[4*x*decimate];
+        int step = 16*decimate;
+        uint16x8_t lo = gray_u16(load_pixels(s, decimate), load_pixels(s + step, decimate), mode);
+        uint16x8_t hi = gray_u16(load_pixels(s + 2*step, decimate), load_pixels(s + 3*step, decimate), mode);
+        vst1q_u8(&dst[x], vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+    return x;
+}
+
+const char *gray_convert_isa()
+{
+    return "neon";
+}
+
+#elif defined(__wasm_simd128__)
+
+static inline v128_t load_pixels(const uint8_t *src, int decimate)
+{
+    v128_t a = wasm_v128_load(src);
+    if (decimate == 1)
+        return a;
+
+    v128_t b = wasm_v128_load(src + 16);
+    return wasm_i32x4_shuffle(a, b, 0, 2, 4, 6);
+}
+
+static inline v128_t gray_i16x8(v128_t p0, v128_t p1, int mode)
+{
+    const v128_t mask = wasm_i32x4_splat(0xff);
+    v128_t r = wasm_i16x8_narrow_i32x4(wasm_v128_and(p0, mask), wasm_v128_and(p1, mask));
+    if (mode != GRAY_LUMA)
+        return r;
+
+    v128_t g = wasm_i16x8_narrow_i32x4(wasm_v128_and(wasm_u32x4_shr(p0, 8), mask),
+                                       wasm_v128_and(wasm_u32x4_shr(p1, 8), mask));
+    v128_t b = wasm_i16x8_narrow_i32x4(wasm_v128_and(wasm_u32x4_shr(p0, 16), mask),
+                                       wasm_v128_and(wasm_u32x4_shr(p1, 16), mask));
+
+    // the weights add up to 256, so the sums fit unsigned 16-bit lanes
+    v128_t y = wasm_i16x8_add(wasm_i16x8_mul(r, wasm_i16x8_splat(77)),
+                              wasm_i16x8_mul(g, wasm_i16x8_splat(150)));
+    y = wasm_i16x8_add(y, wasm_i16x8_mul(b, wasm_i16x8_splat(29)));
+    y = wasm_i16x8_add(y, wasm_i16x8_splat(128));
+    return wasm_u16x8_shr(y, 8);
+}
+
+static int convert_simd(const uint8_t *src, int width, int mode, int decimate, uint8_t *dst)
+{
+    int x = 0;
+    for (; (x + 16) * decimate <= width; x += 16)
+    {
+        const uint8_t *s = &src[4*x*decimate];
+        int step = 16*decimate;
+        v128_t lo = gray_i16x8(load_pixels(s, decimate), load_pixels(s + step, decimate), mode);
+        v128_t hi = gray_i16x8(load_pixels(s + 2*step, decimate), load_pixels(s + 3*step, decimate), mode);
+        wasm_v128_store(&dst[x], wasm_u8x16_narrow_i16x8(lo, hi));
+    }
+    return x;
+}
+
+const char *gray_convert_isa()
+{
+    return "wasm-simd128";
+}
+
+#else
+
+static int convert_simd(const uint8_t *src, int width, int mode, int decimate, uint8_t *dst)
+{
+    return 0;
+}
+
+const char *gray_convert_isa()
+{
+    return "scalar";
+}
+
+#endif
+
+void gray_convert_scalar(const uint8_t *src, int width, int height, int stride, int channels,
+                         int mode, int decimate, image_u8_t *out)
+{
+    int n = gray_decimated_size(width, decimate);
+    for (int y = 0, sy = 0; y < height; y += decimate, sy++)
+        convert_tail(&src[y*stride], 0, n, channels, mode, decimate, &out->buf[sy*out->stride]);
+}
+
+void gray_convert(const uint8_t *src, int width, int height, int stride, int channels,
+                  int mode, int decimate, image_u8_t *out)
+{
+    int n = gray_decimated_size(width, decimate);
+    for (int y = 0, sy = 0; y < height; y += decimate, sy++)
+    {
+        const uint8_t *row = &src[y*stride];
+        uint8_t *dst = &out->buf[sy*out->stride];
+
+        if (channels == 1 && decimate == 1)
+        {
+            memcpy(dst, row, n);
+            continue;
+        }
+
+        int x = 0;
+        if (channels == 4 && decimate <= 2)
+            x = convert_simd(row, width, mode, decimate, dst);
+        convert_tail(row, x, n, channels, mode, decimate, dst);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef _GRAY_CONVERT_H_
+#define _GRAY_CONVERT_H_
+
+#include <stdint.h>
+
+#include "apriltag.h"
+
+/* how gray values are computed from color pixels */
+enum gray_mode
+{
+    // first channel only, what the wasm save_grayscale() always did
+    GRAY_RED = 0,
+    // BT.601 luma of RGB or RGBA pixels, (77 R + 150 G + 29 B + 128) >> 8
+    GRAY_LUMA,
+};
+
+/** Width or height of a frame after keeping every decimate-th pixel, as image_u8_decimate() does. */
+int gray_decimated_size(int size, int decimate);
+
+/**
+ * Convert a frame to grayscale, decimating it in the same pass.
+ *
+ * Every decimate-th pixel of every decimate-th row is kept, which is what
+ * image_u8_decimate() does for integer factors; pass 1 for full resolution.
+ * Quads found in the result are in decimated coordinates, so set
+ * td->quad_decimate to the same factor for them to be scaled back.
+ *
+ * RGBA frames at factors 1 and 2 are converted with SSE2, NEON or WASM
+ * SIMD128 (-msimd128) when the build enables them, gray frames at full
+ * resolution are copied row by row, everything else uses a scalar loop.
+ * All variants write the same pixels.
+ *
+ * @param *src first pixel of the frame
+ * @param width, height size of the frame in pixels
+ * @param stride bytes from one row to the next, at least width * channels
+ * @param channels bytes per pixel: 1 (gray, mode is ignored), 3 (RGB) or 4 (RGBA)
+ * @param mode see enum gray_mode
+ * @param decimate factor, at least 1
+ * @param *out gray_decimated_size(width) by gray_decimated_size(height) image to write
+ */
+void gray_convert(const uint8_t *src, int width, int height, int stride, int channels,
+                  int mode, int decimate, image_u8_t *out);
+
+/** Plain C version of gray_convert(), for reference. */
+void gray_convert_scalar(const uint8_t *src, int width, int height, int stride, int channels,
+                         int mode, int decimate, image_u8_t *out);
+
+/** Name of the instruction set gray_convert() was compiled for. */
+const char *gray_convert_isa();
+
+#endif
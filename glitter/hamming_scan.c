@@ -0,0 +1,205 @@
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#include "hamming_scan.h"
+
+/* continues a scan at entry k with the best (distance, index) found so far */
+static int scan_tail(const uint32_t *table, int k, int n, uint32_t a, uint32_t b,
+                     int best, int best_dist, int *dist)
+{
+    for (; k < n; k++)
+    {
+        int da = __builtin_popcount(table[k] ^ a), db = __builtin_popcount(table[k] ^ b);
+        int d = db < da ? db : da;
+        if (d < best_dist)
+        {
+            best = k;
+            best_dist = d;
+        }
+    }
+    *dist = best_dist;
+    return best;
+}
+
+int hamming_scan_scalar(const uint32_t *table, int n, uint32_t a, uint32_t b, int *dist)
+{
+    return scan_tail(table, 0, n, a, b, -1, 33, dist);
+}
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__wasm_simd128__)
+/* lanes hold the first best entry of every k ≡ lane (mod width); keep the lowest index among ties */
+static void reduce_lanes(const int32_t *lane_dist, const int32_t *lane_idx, int width,
+                         int *best, int *best_dist)
+{
+    *best = -1;
+    *best_dist = 33;
+    for (int l = 0; l < width; l++)
+    {
+        if (lane_dist[l] < *best_dist || (lane_dist[l] == *best_dist && lane_idx[l] < *best))
+        {
+            *best = lane_idx[l];
+            *best_dist = lane_dist[l];
+        }
+    }
+}
+#endif
+
+#if defined(__AVX2__)
+
+/* SWAR popcount of each 32-bit lane */
+static inline __m256i popcount_epi32(__m256i x)
+{
+    x = _mm256_sub_epi32(x, _mm256_and_si256(_mm256_srli_epi32(x, 1), _mm256_set1_epi32(0x55555555)));
+    x = _mm256_add_epi32(_mm256_and_si256(x, _mm256_set1_epi32(0x33333333)),
+                         _mm256_and_si256(_mm256_srli_epi32(x, 2), _mm256_set1_epi32(0x33333333)));
+    x = _mm256_and_si256(_mm256_add_epi32(x, _mm256_srli_epi32(x, 4)), _mm256_set1_epi32(0x0f0f0f0f));
+    x = _mm256_add_epi32(x, _mm256_srli_epi32(x, 8));
+    x = _mm256_add_epi32(x, _mm256_srli_epi32(x, 16));
+    return _mm256_and_si256(x, _mm256_set1_epi32(0x3f));
+}
+
+int hamming_scan(const uint32_t *table, int n, uint32_t a, uint32_t b, int *dist)
+{
+    const __m256i va = _mm256_set1_epi32(a), vb = _mm256_set1_epi32(b);
+    __m256i best_dist = _mm256_set1_epi32(33), best = _mm256_set1_epi32(-1);
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    int k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        __m256i t = _mm256_loadu_si256((const __m256i *)&table[k]);
+        __m256i d = _mm256_min_epi32(popcount_epi32(_mm256_xor_si256(t, va)),
+                                     popcount_epi32(_mm256_xor_si256(t, vb)));
+        __m256i lt = _mm256_cmpgt_epi32(best_dist, d);
+        best_dist = _mm256_blendv_epi8(best_dist, d, lt);
+        best = _mm256_blendv_epi8(best, idx, lt);
+        idx = _mm256_add_epi32(idx, _mm256_set1_epi32(8));
+    }
+
+    int32_t lane_dist[8], lane_idx[8];
+    _mm256_storeu_si256((__m256i *)lane_dist, best_dist);
+    _mm256_storeu_si256((__m256i *)lane_idx, best);
+
+    int best_k, best_d;
+    reduce_lanes(lane_dist, lane_idx, 8, &best_k, &best_d);
+    return scan_tail(table, k, n, a, b, best_k, best_d, dist);
+}
+
+const char *hamming_scan_isa()
+{
+    return "avx2";
+}
+
+#elif defined(__SSE2__)
+
+/* SWAR popcount of each 32-bit lane */
+static inline __m128i popcount_epi32(__m128i x)
+{
+    x = _mm_sub_epi32(x, _mm_and_si128(_mm_srli_epi32(x, 1), _mm_set1_epi32(0x55555555)));
+    x = _mm_add_epi32(_mm_and_si128(x, _mm_set1_epi32(0x33333333)),
+                      _mm_and_si128(_mm_srli_epi32(x, 2), _mm_set1_epi32(0x33333333)));
+    x = _mm_and_si128(_mm_add_epi32(x, _mm_srli_epi32(x, 4)), _mm_set1_epi32(0x0f0f0f0f));
+    x = _mm_add_epi32(x, _mm_srli_epi32(x, 8));
+    x = _mm_add_epi32(x, _mm_srli_epi32(x, 16));
+    return _mm_and_si128(x, _mm_set1_epi32(0x3f));
+}
+
+/* SSE2 has no blend, mask ? a : b */
+static inline __m128i select_epi32(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+int hamming_scan(const uint32_t *table, int n, uint32_t a, uint32_t b, int *dist)
+{
+    const __m128i va = _mm_set1_epi32(a), vb = _mm_set1_epi32(b);
+    __m128i best_dist = _mm_set1_epi32(33), best = _mm_set1_epi32(-1);
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+
+    int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m128i t = _mm_loadu_si128((const __m128i *)&table[k]);
+        __m128i da = popcount_epi32(_mm_xor_si128(t, va));
+        __m128i db = popcount_epi32(_mm_xor_si128(t, vb));
+        __m128i d = select_epi32(_mm_cmplt_epi32(db, da), db, da);
+        __m128i lt = _mm_cmplt_epi32(d, best_dist);
+        best_dist = select_epi32(lt, d, best_dist);
+        best = select_epi32(lt, idx, best);
+        idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+    }
+
+    int32_t lane_dist[4], lane_idx[4];
+    _mm_storeu_si128((__m128i *)lane_dist, best_dist);
+    _mm_storeu_si128((__m128i *)lane_idx, best);
+
+    int best_k, best_d;
+    reduce_lanes(lane_dist, lane_idx, 4, &best_k, &best_d);
+    return scan_tail(table, k, n, a, b, best_k, best_d, dist);
+}
+
+const char *hamming_scan_isa()
+{
+    return "sse2";
+}
+
+#elif defined(__wasm_simd128__)
+
+/* byte popcounts summed pairwise up to 32-bit lanes */
+static inline v128_t popcount_i32x4(v128_t x)
+{
+    return wasm_u32x4_extadd_pairwise_u16x8(wasm_u16x8_extadd_pairwise_u8x16(wasm_i8x16_popcnt(x)));
+}
+
+int hamming_scan(const uint32_t *table, int n, uint32_t a, uint32_t b, int *dist)
+{
+    const v128_t va = wasm_i32x4_splat(a), vb = wasm_i32x4_splat(b);
+    v128_t best_dist = wasm_i32x4_splat(33), best = wasm_i32x4_splat(-1);
+    v128_t idx = wasm_i32x4_make(0, 1, 2, 3);
+
+    int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        v128_t t = wasm_v128_load(&table[k]);
+        v128_t d = wasm_i32x4_min(popcount_i32x4(wasm_v128_xor(t, va)),
+                                  popcount_i32x4(wasm_v128_xor(t, vb)));
+        v128_t lt = wasm_i32x4_lt(d, best_dist);
+        best_dist = wasm_v128_bitselect(d, best_dist, lt);
+        best = wasm_v128_bitselect(idx, best, lt);
+        idx = wasm_i32x4_add(idx, wasm_i32x4_splat(4));
+    }
+
+    int32_t lane_dist[4], lane_idx[4];
+    wasm_v128_store(lane_dist, best_dist);
+    wasm_v128_store(lane_idx, best);
+
+    int best_k, best_d;
+    reduce_lanes(lane_dist, lane_idx, 4, &best_k, &best_d);
+    return scan_tail(table, k, n, a, b, best_k, best_d, dist);
+}
+
+const char *hamming_scan_isa()
+{
+    return "wasm-simd128";
+}
+
+#else
+
+int hamming_scan(const uint32_t *table, int n, uint32_t a, uint32_t b, int *dist)
+{
+    return hamming_scan_scalar(table, n, a, b, dist);
+}
+
+const char *hamming_scan_isa()
+{
+    return "scalar";
+}
+
+#endif
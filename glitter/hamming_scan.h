@@ -0,0 +1,22 @@
+#ifndef _HAMMING_SCAN_H_
+#define _HAMMING_SCAN_H_
+
+#include <stdint.h>
+
+/**
+ * Index of the first entry of table[0..n) closest to either a or b in Hamming
+ * distance (an entry counts with the smaller of its two distances), or -1 if n is 0.
+ * The distance is stored in *dist.
+ *
+ * Compiled for the best instruction set the build enables: AVX2 (-mavx2), SSE2,
+ * WASM SIMD128 (-msimd128), or plain C. All variants return the same index.
+ */
+int hamming_scan(const uint32_t *table, int n, uint32_t a, uint32_t b, int *dist);
+
+/** Plain C version of hamming_scan(), for reference. */
+int hamming_scan_scalar(const uint32_t *table, int n, uint32_t a, uint32_t b, int *dist);
+
+/** Name of the instruction set hamming_scan() was compiled for. */
+const char *hamming_scan_isa();
+
+#endif
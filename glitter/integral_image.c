@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "integral_image.h"
+
+/* prefix sum of one row, dst[0] = 0 and dst[x + 1] = src[0] + ... + src[x] */
+static void integral_row(const uint8_t *src, uint32_t *dst, int width)
+{
+    int x = 0;
+    dst[0] = 0;
+
+#ifdef __SSE2__
+    // 8 pixels at a time: log-step prefix sum in 16-bit lanes (max 8*255),
+    // then widen and add the running total of the row so far
+    const __m128i zero = _mm_setzero_si128();
+    __m128i offset = zero;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&src[x]), zero);
+        v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+
+        __m128i lo = _mm_add_epi32(offset, _mm_unpacklo_epi16(v, zero));
+        __m128i hi = _mm_add_epi32(offset, _mm_unpackhi_epi16(v, zero));
+        _mm_storeu_si128((__m128i *)&dst[x + 1], lo);
+        _mm_storeu_si128((__m128i *)&dst[x + 5], hi);
+        offset = _mm_shuffle_epi32(hi, 0xff);
+    }
+#endif
+
+    uint32_t acc = dst[x];
+    for (; x < width; x++)
+    {
+        acc += src[x];
+        dst[x + 1] = acc;
+    }
+}
+
+integral_image_t *integral_image_create()
+{
+    return calloc(1, sizeof(integral_image_t));
+}
+
+void integral_image_update(integral_image_t *ii, image_u8_t *im)
+{
+    ii->width = im->width;
+    ii->height = im->height;
+    ii->stride = im->width + 1;
+
+    // only grows, so steady-state frames do not allocate
+    int size = ii->stride * ii->height;
+    if (size > ii->capacity)
+    {
+        free(ii->buf);
+        ii->buf = malloc(size * sizeof(uint32_t));
+        ii->capacity = size;
+        ii->grows++;
+    }
+
+    for (int y = 0; y < im->height; y++)
+        integral_row(&im->buf[y*im->stride], &ii->buf[y*ii->stride], im->width);
+}
+
+void integral_image_destroy(integral_image_t *ii)
+{
+    if (ii == NULL)
+        return;
+
+    free(ii->buf);
+    free(ii);
+}
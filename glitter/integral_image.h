@@ -0,0 +1,38 @@
+#ifndef _INTEGRAL_IMAGE_H_
+#define _INTEGRAL_IMAGE_H_
+
+#include "apriltag.h"
+
+/**
+ * Row-wise integral image: buf[y*stride + x] holds the sum of the first x pixels of row y,
+ * so any horizontal span costs two lookups. Spans are all the brightness extractor needs;
+ * a full 2D table would just add work per lookup.
+ */
+typedef struct integral_image integral_image_t;
+struct integral_image
+{
+    int width;
+    int height;
+
+    // width + 1, column 0 is always zero
+    int stride;
+
+    int capacity;
+    uint32_t *buf;
+
+    // times buf was reallocated to a larger capacity
+    int grows;
+};
+
+integral_image_t *integral_image_create();
+void integral_image_update(integral_image_t *ii, image_u8_t *im);
+void integral_image_destroy(integral_image_t *ii);
+
+/** Sum of pixels x0..x1 (inclusive) of row y. */
+static inline uint32_t integral_image_span(integral_image_t *ii, int y, int x0, int x1)
+{
+    const uint32_t *row = &ii->buf[y*ii->stride];
+    return row[x1 + 1] - row[x0];
+}
+
+#endif
@@ -1,117 +1,190 @@
 #include <math.h>
 #include "apriltag.h"
 #include "common/zarray.h"
-#include "common/homography.h"
+#include "common/matd.h"
 #include "common/g2d.h"
 #include "common/math_util.h"
 #include "lightanchor.h"
 #include "queue_buf.h"
-
-lightanchor_t *lightanchor_create(struct quad *quad)
-{
-    if (quad->H == NULL)
-        return NULL;
-
-    lightanchor_t *la = calloc(1, sizeof(lightanchor_t));
-    la->p[0][0] = quad->p[0][0];
-    la->p[0][1] = quad->p[0][1];
-    la->p[1][0] = quad->p[1][0];
-    la->p[1][1] = quad->p[1][1];
-    la->p[2][0] = quad->p[2][0];
-    la->p[2][1] = quad->p[2][1];
-    la->p[3][0] = quad->p[3][0];
-    la->p[3][1] = quad->p[3][1];
-
-    la->H = matd_copy(quad->H);
-    homography_project(la->H, 0, 0, &la->c[0], &la->c[1]);
-    return la;
-}
+#include "integral_image.h"
 
 /** @copydoc lightanchor_copy */
 lightanchor_t *lightanchor_copy(lightanchor_t *old)
 {
     lightanchor_t *new = malloc(sizeof(lightanchor_t));
     memcpy(new, old, sizeof(lightanchor_t));
-    if (old->H)
-        new->H = matd_copy(old->H);
     return new;
 }
 
 void lightanchor_destroy(lightanchor_t *la) {
-    if (la == NULL)
-        return;
-
-    if (la->H)
-        matd_destroy(la->H);
     free(la);
 }
 
 void lightanchor_update(lightanchor_t *src, lightanchor_t *dest) {
+    dest->dc[0] = dest->c[0] - src->c[0];
+    dest->dc[1] = dest->c[1] - src->c[1];
+
     dest->valid = src->valid;
     dest->frames = src->frames;
     dest->match_code = src->match_code;
     dest->code = src->code;
     dest->next_code = src->next_code;
+    dest->nbits = src->nbits;
 
     qb_copy(&dest->brightnesses, &src->brightnesses);
 }
 
-static void lightanchor_stats(lightanchor_t *la, double max[], double min[]) {
+static void quad_stats(double p[4][2], double max[], double min[]) {
     max[0] = 0;
     max[1] = 0;
     min[0] = MAX_DIST;
     min[1] = MAX_DIST;
     for (int i = 0; i < 4; i++)
     {
-        if (la->p[i][0] > max[0])
-            max[0] = la->p[i][0];
+        if (p[i][0] > max[0])
+            max[0] = p[i][0];
 
-        if (la->p[i][0] < min[0])
-            min[0] = la->p[i][0];
+        if (p[i][0] < min[0])
+            min[0] = p[i][0];
 
-        if (la->p[i][1] > max[1])
-            max[1] = la->p[i][1];
+        if (p[i][1] > max[1])
+            max[1] = p[i][1];
 
-        if (la->p[i][1] < min[1])
-            min[1] = la->p[i][1];
+        if (p[i][1] < min[1])
+            min[1] = p[i][1];
     }
 }
 
-uint8_t extract_brightness(lightanchor_t *la, image_u8_t *im) {
-    int avg = 0, n = 0;
+/**
+ * Horizontal extent of the (convex) quad along the scanline y.
+ * Edges are treated as half-open in y so shared vertices are only hit once.
+ * Returns 0 if the scanline misses the quad.
+ */
+static int quad_row_span(double p[4][2], double y, double *xl, double *xr)
+{
+    int hits = 0;
+    *xl = MAX_DIST;
+    *xr = -MAX_DIST;
+    for (int i = 0; i < 4; i++)
+    {
+        double *a = p[i], *b = p[(i + 1) & 3];
+        if ((a[1] <= y) == (b[1] <= y))
+            continue;
+
+        double x = a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]);
+        if (x < *xl) *xl = x;
+        if (x > *xr) *xr = x;
+        hits++;
+    }
+    return hits >= 2;
+}
 
+/**
+ * Columns x0..x1 of row y whose pixel centers (x+0.5, y+0.5) lie inside the quad,
+ * clipped to the image. Returns 0 if there are none.
+ */
+static int quad_pixel_span(double p[4][2], int y, int width, int *x0, int *x1)
+{
+    double xl, xr;
+    if (!quad_row_span(p, y + 0.5, &xl, &xr))
+        return 0;
+
+    *x0 = imax(0, (int)ceil(xl - 0.5));
+    *x1 = imin(width - 1, (int)floor(xr - 0.5));
+    return *x1 >= *x0;
+}
+
+static void quad_row_range(double p[4][2], int height, int *y0, int *y1)
+{
     double max[2], min[2];
-    lightanchor_stats(la, max, min);
-
-    int maxi[2], mini[2];
-    maxi[0] = (int)ceil(max[0]-0.5);
-    mini[0] = (int)ceil(min[0]-0.5);
-    maxi[1] = (int)ceil(max[1]-0.5);
-    mini[1] = (int)ceil(min[1]-0.5);
-
-    zarray_t *quad_poly = g2d_polygon_create_data(la->p, 4);
-
-    double p[2];
-    for (int ix = mini[0]; ix <= maxi[0]; ix++) {
-        for (int iy = mini[1]; iy <= maxi[1]; iy++) {
-            p[0] = (double)ix;
-            p[1] = (double)iy;
-            if (g2d_polygon_contains_point(quad_poly, p)) {
-                avg += value_for_pixel(im, ix, iy);
-                n++;
-            }
-        }
+    quad_stats(p, max, min);
+
+    *y0 = imax(0, (int)ceil(min[1] - 0.5));
+    *y1 = imin(height - 1, (int)floor(max[1] - 0.5));
+}
+
+/**
+ * Mean intensity of the pixels whose centers lie inside the quad.
+ * Each row span is computed once from the quad edges and summed straight from im->buf.
+ *
+ * The previous implementation averaged value_for_pixel() at integer coordinates, i.e.
+ * the 2x2 box around each pixel corner (truncated per sample), and counted samples
+ * falling outside the image as -1. Results therefore differ by at most a couple of
+ * gray levels on interior quads; quads clipped by the image border no longer get
+ * pulled towards zero.
+ */
+uint8_t quad_brightness(double p[4][2], image_u8_t *im) {
+    int y0, y1;
+    quad_row_range(p, im->height, &y0, &y1);
+
+    uint64_t sum = 0;
+    int n = 0;
+    for (int y = y0; y <= y1; y++) {
+        int x0, x1;
+        if (!quad_pixel_span(p, y, im->width, &x0, &x1))
+            continue;
+
+        const uint8_t *row = &im->buf[y*im->stride];
+        for (int x = x0; x <= x1; x++)
+            sum += row[x];
+        n += x1 - x0 + 1;
     }
 
     uint8_t res = 0;
     if (n > 0) {
-        res = (uint8_t)(avg / n);
+        res = (uint8_t)(sum / n);
+    }
+    return res;
+}
+
+/**
+ * Same result as quad_brightness(), but each row span is two lookups into
+ * an integral image of the frame, so the cost is O(rows) instead of O(area).
+ */
+uint8_t quad_brightness_integral(double p[4][2], integral_image_t *ii) {
+    int y0, y1;
+    quad_row_range(p, ii->height, &y0, &y1);
+
+    uint64_t sum = 0;
+    int n = 0;
+    for (int y = y0; y <= y1; y++) {
+        int x0, x1;
+        if (!quad_pixel_span(p, y, ii->width, &x0, &x1))
+            continue;
+
+        sum += integral_image_span(ii, y, x0, x1);
+        n += x1 - x0 + 1;
     }
 
-    zarray_destroy(quad_poly);
+    uint8_t res = 0;
+    if (n > 0) {
+        res = (uint8_t)(sum / n);
+    }
     return res;
 }
 
+uint8_t extract_brightness(lightanchor_t *la, image_u8_t *im) {
+    return quad_brightness(la->p, im);
+}
+
+uint8_t extract_brightness_integral(lightanchor_t *la, integral_image_t *ii) {
+    return quad_brightness_integral(la->p, ii);
+}
+
+double quad_area(double p[4][2]) {
+    double area = 0;
+    for (int i = 0; i < 4; i++) {
+        int j = (i + 1) & 3;
+        area += p[i][0] * p[j][1] - p[j][0] * p[i][1];
+    }
+    return fabs(area) / 2;
+}
+
+/** @copydoc lightanchor_area */
+double lightanchor_area(lightanchor_t *la) {
+    return quad_area(la->p);
+}
+
 /** @copydoc lightanchors_destroy */
 int lightanchors_destroy(zarray_t *lightanchors)
 {
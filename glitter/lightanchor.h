@@ -4,6 +4,7 @@
 #include "apriltag.h"
 #include "common/zarray.h"
 #include "queue_buf.h"
+#include "integral_image.h"
 
 #define MAX_DIST    1000000
 
@@ -14,30 +15,51 @@ extern double g2d_distance(const double a[2], const double b[2]);
 typedef struct lightanchor lightanchor_t;
 struct lightanchor
 {
+    // track id, 0 until the candidate first decodes, see lightanchor_detector_events()
+    uint32_t id;
+
     char valid;
-    uint8_t match_code;
+    uint32_t match_code;
+
+    // last 2*code_width samples, one bit each, and the word expected next frame
+    uint64_t code;
+    uint64_t next_code;
 
-    uint16_t code;
-    uint16_t next_code;
+    // samples shifted into code so far, counting up to a full window, see decode_sample()
+    uint8_t nbits;
 
     int frames;
 
     double min_dist;
 
-    matd_t *H;
+    // homography, row major
+    double H[9];
 
     double c[2];
     double p[4][2];
 
+    // motion of the center since the previous frame
+    double dc[2];
+
+    // average distance from each corner to the center, used to compare shapes
+    double shape;
+
     struct queue_buf brightnesses;
 };
 
-lightanchor_t *lightanchor_create(struct quad *quad);
 lightanchor_t *lightanchor_copy(lightanchor_t *lightanchor);
 void lightanchor_update(lightanchor_t *src, lightanchor_t *dest);
 void lightanchor_destroy(lightanchor_t *lightanchor);
+/* frees an array of lightanchor_copy() results, not the one decode_tags() returns */
 int lightanchors_destroy(zarray_t *lightanchors);
 uint8_t extract_brightness(lightanchor_t *l, image_u8_t *im);
+uint8_t extract_brightness_integral(lightanchor_t *l, integral_image_t *ii);
+double lightanchor_area(lightanchor_t *l);
+
+/* same as above, for the corners of a quad */
+uint8_t quad_brightness(double p[4][2], image_u8_t *im);
+uint8_t quad_brightness_integral(double p[4][2], integral_image_t *ii);
+double quad_area(double p[4][2]);
 int quads_destroy(zarray_t *quads);
 
 #endif
@@ -7,6 +7,7 @@
  *
  */
 #include <math.h>
+#include <stdlib.h>
 
 #include "common/zarray.h"
 #include "common/homography.h"
@@ -20,6 +21,76 @@
 #include "lightanchor_detector.h"
 #include "bit_match.h"
 #include "queue_buf.h"
+#include "integral_image.h"
+#include "spatial_grid.h"
+#include "assignment.h"
+#include "candidate_table.h"
+
+// same chunking target as apriltag's quad decode
+#define TASKS_PER_THREAD_TARGET 10
+
+#ifndef GLITTER_NO_STATS
+#define STATS_ENABLED(ld) ((ld)->collect_stats)
+#else
+#define STATS_ENABLED(ld) 0
+#endif
+
+struct quad_task
+{
+    int i0, i1;
+    zarray_t *quads;
+    apriltag_detector_t *td;
+    image_u8_t *im;
+
+    // time spent in this chunk, only measured when stats is set
+    int stats;
+    uint64_t ns_refine, ns_homography;
+};
+
+struct candidate_task
+{
+    int i0, i1;
+    lightanchor_detector_t *ld;
+    candidate_table_t *new_tags;
+    image_u8_t *im;
+    int integral;
+
+    // struct candidate_result of this chunk, in candidate order, and the times it grew
+    zarray_t *results;
+    uint64_t nallocs;
+
+    // time spent and tracked candidates that stayed on their phase in this chunk,
+    // only measured when stats is set; lookups are counted in decode_candidates()
+    int stats;
+    uint64_t ns_brightness, ns_decode;
+    int hits;
+};
+
+/* zarray_add(), counting in *nallocs when the array has to be reallocated */
+static void add_counted(zarray_t *za, const void *p, uint64_t *nallocs)
+{
+    int alloc = za->alloc;
+    zarray_add(za, p);
+    *nallocs += za->alloc != alloc;
+}
+
+/* reallocations made by the tables, integral image, grid and solver, see ld->nallocs */
+static int buffer_grows(lightanchor_detector_t *ld)
+{
+    return ld->candidates->grows + ld->new_tags->grows + ld->integral->grows +
+        ld->grid->grows + ld->assignment->grows;
+}
+
+// candidate_result type of a word left for the match_codes() batch in decode_candidates()
+#define RESULT_LOOKUP           -1
+
+/* a track event of candidate_task(); ACQUIRED ids are handed out once the tasks are done */
+struct candidate_result
+{
+    int row;
+    int type;
+    uint32_t id;
+};
 
 apriltag_family_t *lightanchor_family_create()
 {
@@ -47,27 +118,163 @@ lightanchor_detector_t *lightanchor_detector_create()
     lightanchor_detector_t *ld =
         (lightanchor_detector_t *)calloc(1, sizeof(lightanchor_detector_t));
 
-    ld->candidates = zarray_create(sizeof(lightanchor_t *));
+    ld->candidates = candidate_table_create();
     ld->codes = zarray_create(sizeof(glitter_code_t));
+    ld->code_index = zarray_create(sizeof(glitter_code_index_t));
+    ld->code_rotations = zarray_create(sizeof(uint32_t));
+    lightanchor_detector_set_code_width(ld, CODE_WIDTH_DEFAULT);
+
+    ld->brightness_mode = BRIGHTNESS_AUTO;
+    ld->integral_area_frac = 0.25;
+    ld->integral = integral_image_create();
+    ld->grid = spatial_grid_create();
+    ld->assignment = assignment_create();
+
+    ld->new_tags = candidate_table_create();
+    ld->detection_arena = zarray_create(sizeof(lightanchor_t));
+    ld->detections = zarray_create(sizeof(lightanchor_t *));
+    ld->quad_tasks = zarray_create(sizeof(struct quad_task));
+    ld->candidate_tasks = zarray_create(sizeof(struct candidate_task));
+    ld->events = zarray_create(sizeof(lightanchor_event_t));
+    ld->track_ids = zarray_create(sizeof(uint32_t));
+
+    ld->roi_full_every = 30;
+    ld->roi_pad = 16;
+    ld->rois = zarray_create(sizeof(int[4]));
 
     return ld;
 }
 
-int lightanchor_detector_add_code(lightanchor_detector_t *ld, char code)
+int lightanchor_detector_set_code_width(lightanchor_detector_t *ld, int width)
 {
+    if (width != 8 && width != 12 && width != 16 && width != 24 && width != 32)
+        return -1;
+
+    ld->code_width = width;
+    ld->brightness_window = 2*width;
+
+    zarray_clear(ld->codes);
+    zarray_clear(ld->code_index);
+    zarray_clear(ld->code_rotations);
+    free(ld->code_lut);
+    free(ld->code_lut_dist);
+    free(ld->code_lut_rot);
+    ld->code_lut = NULL;
+    ld->code_lut_dist = NULL;
+    ld->code_lut_rot = NULL;
+
+    if (width <= CODE_LUT_MAX_WIDTH)
+    {
+        int size = 1 << width;
+        ld->code_lut = malloc(size * sizeof(int16_t));
+        ld->code_lut_dist = calloc(size, sizeof(uint8_t));
+        ld->code_lut_rot = calloc(size, sizeof(uint8_t));
+        for (int i = 0; i < size; i++)
+            ld->code_lut[i] = -1;
+    }
+
+    return 0;
+}
+
+int lightanchor_detector_add_code(lightanchor_detector_t *ld, uint32_t code)
+{
+    code &= (uint32_t)((1ULL << ld->code_width) - 1);
+
     glitter_code_t glitter_code;
     glitter_code.code = code;
     glitter_code.doubled_code = double_bits(code);
+    glitter_code.canonical = canonical_rotation(code, ld->code_width);
+
+    for (int i = 0; i < zarray_size(ld->codes); i++)
+    {
+        glitter_code_t *other;
+        zarray_get_volatile(ld->codes, i, &other);
+        if (other->canonical == glitter_code.canonical)
+            return -1;
+    }
 
     zarray_add(ld->codes, &glitter_code);
+    code_lut_add(ld, glitter_code.code, zarray_size(ld->codes) - 1);
 
     return 0;
 }
 
+void lightanchor_detector_get_stats(lightanchor_detector_t *ld, detector_stats_t *out)
+{
+    *out = ld->stats;
+}
+
+void lightanchor_detector_reset_stats(lightanchor_detector_t *ld)
+{
+    memset(&ld->stats, 0, sizeof(detector_stats_t));
+}
+
+zarray_t *lightanchor_detector_events(lightanchor_detector_t *ld)
+{
+    return ld->events;
+}
+
+int lightanchor_detector_get_detections(lightanchor_detector_t *ld,
+                                        lightanchor_detection_t *out, int capacity)
+{
+    // the events hold the track state of every detection
+    int n = 0;
+    for (int i = 0; i < zarray_size(ld->events); i++)
+    {
+        lightanchor_event_t *ev;
+        zarray_get_volatile(ld->events, i, &ev);
+        if (ev->type == LIGHTANCHOR_LOST)
+            continue;
+
+        if (n < capacity)
+        {
+            lightanchor_t *la;
+            zarray_get_volatile(ld->detection_arena, ev->detection, &la);
+
+            lightanchor_detection_t *det = &out[n];
+            det->id = ev->id;
+            det->match_code = ev->match_code;
+            det->state = ev->type;
+            memcpy(det->c, la->c, sizeof(det->c));
+            memcpy(det->p, la->p, sizeof(det->p));
+            memcpy(det->H, la->H, sizeof(det->H));
+        }
+        n++;
+    }
+    return n;
+}
+
 void lightanchor_detector_destroy(lightanchor_detector_t *ld)
 {
-    lightanchors_destroy(ld->candidates);
+    candidate_table_destroy(ld->candidates);
+    candidate_table_destroy(ld->new_tags);
+    zarray_destroy(ld->detection_arena);
+    zarray_destroy(ld->detections);
+    zarray_destroy(ld->quad_tasks);
+    for (int i = 0; i < zarray_size(ld->candidate_tasks); i++)
+    {
+        struct candidate_task *task;
+        zarray_get_volatile(ld->candidate_tasks, i, &task);
+        zarray_destroy(task->results);
+    }
+    zarray_destroy(ld->candidate_tasks);
+    zarray_destroy(ld->events);
+    zarray_destroy(ld->track_ids);
     zarray_destroy(ld->codes);
+    zarray_destroy(ld->code_index);
+    zarray_destroy(ld->code_rotations);
+    free(ld->code_lut);
+    free(ld->code_lut_dist);
+    free(ld->code_lut_rot);
+    image_u8_destroy(ld->quad_im);
+    zarray_destroy(ld->rois);
+    free(ld->roi_buf);
+    free(ld->lookup_words);
+    free(ld->lookup_idx);
+    free(ld->lookup_rot);
+    integral_image_destroy(ld->integral);
+    spatial_grid_destroy(ld->grid);
+    assignment_destroy(ld->assignment);
     free(ld);
 }
 
@@ -220,153 +427,746 @@ static void refine_edges(apriltag_detector_t *td,
     }
 }
 
-zarray_t *detect_quads(apriltag_detector_t *td, image_u8_t *im_orig)
+static void update_workerpool(apriltag_detector_t *td)
 {
     if (td->wp == NULL || td->nthreads != workerpool_get_nthreads(td->wp))
     {
         workerpool_destroy(td->wp);
         td->wp = workerpool_create(td->nthreads);
     }
+}
 
-    image_u8_t *quad_im = image_u8_copy(im_orig);
-    zarray_t *quads = apriltag_quad_thresh(td, quad_im);
+zarray_t *detect_quads(apriltag_detector_t *td, image_u8_t *im_orig)
+{
+    image_u8_t *quad_im = NULL;
+    zarray_t *quads = detect_quads_scratch(td, im_orig, &quad_im);
+    image_u8_destroy(quad_im);
+    return quads;
+}
 
-    if (quad_im != im_orig)
+zarray_t *detect_quads_scratch(apriltag_detector_t *td, image_u8_t *im_orig, image_u8_t **scratch)
+{
+    update_workerpool(td);
+
+    // caller says im_orig may be clobbered
+    if (scratch == NULL)
+        return apriltag_quad_thresh(td, im_orig);
+
+    image_u8_t *quad_im = *scratch;
+    if (quad_im == NULL || quad_im->width != im_orig->width ||
+        quad_im->height != im_orig->height || quad_im->stride != im_orig->stride)
+    {
         image_u8_destroy(quad_im);
+        quad_im = image_u8_create_stride(im_orig->width, im_orig->height, im_orig->stride);
+        *scratch = quad_im;
+    }
+    memcpy(quad_im->buf, im_orig->buf, im_orig->height * im_orig->stride);
 
-    return quads;
+    return apriltag_quad_thresh(td, quad_im);
 }
 
-static zarray_t *update_candidates(lightanchor_detector_t *ld,
-                                   zarray_t *new_tags, image_u8_t *im)
+/*
+ * padded bounding boxes of live candidates at their predicted positions, merged;
+ * undecoded ones are included so they keep being sampled until they decode
+ */
+static void predict_rois(lightanchor_detector_t *ld, image_u8_t *im)
 {
-    zarray_t *detections = zarray_create(sizeof(lightanchor_t *));
+    zarray_clear(ld->rois);
 
-    if (zarray_size(ld->candidates) == 0)
+    candidate_table_t *candidates = ld->candidates;
+    for (int i = 0; i < candidates->size; i++)
     {
-        for (int i = 0; i < zarray_size(new_tags); i++)
+        double min[2] = { MAX_DIST, MAX_DIST }, max[2] = { -MAX_DIST, -MAX_DIST };
+        for (int j = 0; j < 4; j++)
         {
-            lightanchor_t *candidate;
-            zarray_get(new_tags, i, &candidate);
-            zarray_add(ld->candidates, &candidate);
+            for (int k = 0; k < 2; k++)
+            {
+                double v = candidates->p[i][j][k] + candidates->dc[i][k];
+                min[k] = fmin(min[k], v);
+                max[k] = fmax(max[k], v);
+            }
         }
-        zarray_destroy(new_tags);
+
+        int roi[4];
+        roi[0] = imax(0, (int)floor(min[0]) - ld->roi_pad);
+        roi[1] = imax(0, (int)floor(min[1]) - ld->roi_pad);
+        roi[2] = imin(im->width, (int)ceil(max[0]) + ld->roi_pad);
+        roi[3] = imin(im->height, (int)ceil(max[1]) + ld->roi_pad);
+        if (roi[2] > roi[0] && roi[3] > roi[1])
+            add_counted(ld->rois, roi, &ld->nallocs);
     }
-    else {
-        for (int i = 0; i < zarray_size(ld->candidates); i++)
-        {
-            lightanchor_t *old_tag, *match_tag = NULL;
-            zarray_get(ld->candidates, i, &old_tag);
 
-            double dist, dist_shape = -1;
-            double min_dist = MAX_DIST, min_dist_shape = MAX_DIST;
-            // search for closest tag
-            for (int j = 0; j < zarray_size(new_tags); j++)
+    // overlapping regions would report the same quad twice
+    int merged = 1;
+    while (merged)
+    {
+        merged = 0;
+        for (int i = 0; i < zarray_size(ld->rois); i++)
+        {
+            int *a;
+            zarray_get_volatile(ld->rois, i, &a);
+            for (int j = i + 1; j < zarray_size(ld->rois); j++)
             {
-                lightanchor_t *new_tag;
-                zarray_get(new_tags, j, &new_tag);
-
-                // double dist = ( g2d_distance(old_tag->p[0], new_tag->p[0]) +
-                //                 g2d_distance(old_tag->p[1], new_tag->p[1]) +
-                //                 g2d_distance(old_tag->p[2], new_tag->p[2]) +
-                //                 g2d_distance(old_tag->p[3], new_tag->p[3]) ) / 4;
-                dist = g2d_distance(old_tag->c, new_tag->c);
-
-                // reject tags with dissimilar shape
-                // shape is represented as the average distance from each corner to the center
-                // not scale invariant!
-                double dist_shape_new = (g2d_distance(new_tag->p[0], new_tag->c) +
-                                            g2d_distance(new_tag->p[1], new_tag->c) +
-                                            g2d_distance(new_tag->p[2], new_tag->c) +
-                                            g2d_distance(new_tag->p[3], new_tag->c)) / 4;
-                double dist_shape_old = (g2d_distance(old_tag->p[0], old_tag->c) +
-                                            g2d_distance(old_tag->p[1], old_tag->c) +
-                                            g2d_distance(old_tag->p[2], old_tag->c) +
-                                            g2d_distance(old_tag->p[3], old_tag->c)) / 4;
-                dist_shape = fabs(dist_shape_new - dist_shape_old);
-
-                if ((dist < min_dist) && (dist_shape < min_dist_shape) &&
-                    (dist < ld->thres_dist_center) && (dist_shape < ld->thres_dist_shape))
+                int *b;
+                zarray_get_volatile(ld->rois, j, &b);
+                if (a[0] < b[2] && b[0] < a[2] && a[1] < b[3] && b[1] < a[3])
                 {
-                    min_dist = dist;
-                    min_dist_shape = dist_shape;
-                    match_tag = new_tag;
+                    a[0] = imin(a[0], b[0]);
+                    a[1] = imin(a[1], b[1]);
+                    a[2] = imax(a[2], b[2]);
+                    a[3] = imax(a[3], b[3]);
+                    zarray_remove_index(ld->rois, j, 1);
+                    merged = 1;
+                    j = i;
                 }
             }
+        }
+    }
+}
+
+zarray_t *detect_quads_tracked(apriltag_detector_t *td, lightanchor_detector_t *ld, image_u8_t *im)
+{
+    int tracks = 0;
+    for (int i = 0; i < ld->candidates->size; i++)
+        tracks += ld->candidates->valid[i];
+
+    int lost = tracks < ld->roi_tracks;
+    ld->roi_tracks = tracks;
+
+    uint64_t t0 = STATS_ENABLED(ld) ? stats_now_ns() : 0;
+    uint64_t nallocs = ld->nallocs;
+
+    if (!ld->track_roi || tracks == 0 || lost || ++ld->roi_frames >= ld->roi_full_every)
+    {
+        ld->roi_frames = 0;
+
+        image_u8_t *scratch = ld->quad_im;
+        zarray_t *quads = detect_quads_scratch(td, im, &ld->quad_im);
+        ld->nallocs += ld->quad_im != scratch;
+        if (STATS_ENABLED(ld))
+        {
+            ld->stats.ns[STAGE_QUAD_THRESH] += stats_now_ns() - t0;
+            ld->stats.counters[COUNTER_ALLOCATIONS] += ld->nallocs - nallocs;
+        }
+        return quads;
+    }
+
+    update_workerpool(td);
+    predict_rois(ld, im);
+
+    zarray_t *quads = zarray_create(sizeof(struct quad));
+    for (int i = 0; i < zarray_size(ld->rois); i++)
+    {
+        int *roi;
+        zarray_get_volatile(ld->rois, i, &roi);
+        int width = roi[2] - roi[0], height = roi[3] - roi[1];
+
+        if (width * height > ld->roi_buf_size)
+        {
+            free(ld->roi_buf);
+            ld->roi_buf_size = width * height;
+            ld->roi_buf = malloc(ld->roi_buf_size);
+            ld->nallocs++;
+        }
+
+        // thresholding may modify its input, so work on a copy of the region
+        image_u8_t sub = {
+            .width = width,
+            .height = height,
+            .stride = width,
+            .buf = ld->roi_buf
+        };
+        for (int y = 0; y < height; y++)
+            memcpy(&sub.buf[y*width], &im->buf[(roi[1] + y)*im->stride + roi[0]], width);
+
+        zarray_t *roi_quads = apriltag_quad_thresh(td, &sub);
+        for (int j = 0; j < zarray_size(roi_quads); j++)
+        {
+            struct quad *quad;
+            zarray_get_volatile(roi_quads, j, &quad);
+            for (int k = 0; k < 4; k++)
+            {
+                quad->p[k][0] += roi[0];
+                quad->p[k][1] += roi[1];
+            }
+            zarray_add(quads, quad);
+        }
+        zarray_destroy(roi_quads);
+    }
+
+    if (STATS_ENABLED(ld))
+    {
+        ld->stats.ns[STAGE_QUAD_THRESH] += stats_now_ns() - t0;
+        ld->stats.counters[COUNTER_ALLOCATIONS] += ld->nallocs - nallocs;
+    }
+    return quads;
+}
+
+static int use_integral_image(lightanchor_detector_t *ld,
+                              candidate_table_t *candidates, image_u8_t *im)
+{
+    if (ld->brightness_mode != BRIGHTNESS_AUTO)
+        return ld->brightness_mode == BRIGHTNESS_INTEGRAL;
+
+    // building the table touches every pixel once, scanlines touch every candidate pixel once
+    double area = 0;
+    for (int i = 0; i < candidates->size; i++)
+        area += quad_area(candidates->p[i]);
+    return area > ld->integral_area_frac * im->width * im->height;
+}
+
+/**
+ * Carry unmatched old tag i over to this frame while its ttl lasts.
+ * Uses a stricter shape threshold, compared against the most recently added tag.
+ */
+static int keep_alive(lightanchor_detector_t *ld, candidate_table_t *old_tags, int i,
+                      candidate_table_t *new_tags)
+{
+    if ((old_tags->frames[i] <= 0) || (new_tags->size == 0))
+        return 0;
+
+    int last = new_tags->size - 1;
+    if (fabs(new_tags->shape[last] - old_tags->shape[i]) >= ld->thres_dist_shape_ttl)
+        return 0;
+
+    int k = candidate_table_append(new_tags, old_tags, i);
+    new_tags->frames[k]--;
+    if (STATS_ENABLED(ld))
+        ld->stats.counters[COUNTER_TTL_CARRIES]++;
+    return 1;
+}
+
+static void associate_greedy(lightanchor_detector_t *ld, candidate_table_t *new_tags)
+{
+    candidate_table_t *old_tags = ld->candidates;
+
+    for (int i = 0; i < old_tags->size; i++)
+    {
+        int match = -1;
+
+        double min_dist = MAX_DIST, min_dist_shape = MAX_DIST;
+        // search for closest tag, in the same order as new_tags
+        zarray_t *neighbors = spatial_grid_query(ld->grid, old_tags->c[i]);
+        for (int k = 0; k < zarray_size(neighbors); k++)
+        {
+            int j;
+            zarray_get(neighbors, k, &j);
+
+            double dist = g2d_distance(old_tags->c[i], new_tags->c[j]);
+
+            // reject tags with dissimilar shape
+            double dist_shape = fabs(new_tags->shape[j] - old_tags->shape[i]);
 
-            if (match_tag != NULL)
+            if ((dist < min_dist) && (dist_shape < min_dist_shape) &&
+                (dist < ld->thres_dist_center) && (dist_shape < ld->thres_dist_shape))
             {
-                // only the closest match_tag can be matched with a prev tag
-                if (match_tag->min_dist == 0 || min_dist < match_tag->min_dist)
-                {
-                    lightanchor_update(old_tag, match_tag);
-                    match_tag->min_dist = min_dist;
-                }
+                min_dist = dist;
+                min_dist_shape = dist_shape;
+                match = j;
             }
-            // stricter shape distance threshold for tags that have a ttl
-            else if ((old_tag->frames > 0) &&
-                     (dist_shape != -1) && (dist_shape < ld->thres_dist_shape_ttl)) {
-                old_tag->frames--;
-                zarray_add(new_tags, &old_tag);
-                zarray_remove_index(ld->candidates, i, 1);
-                i--;
+        }
+
+        if (match >= 0)
+        {
+            // only the closest match can be matched with a prev tag
+            if (new_tags->min_dist[match] == 0 || min_dist < new_tags->min_dist[match])
+            {
+                candidate_table_update(new_tags, match, old_tags, i);
+                new_tags->min_dist[match] = min_dist;
             }
         }
+        else if (keep_alive(ld, old_tags, i, new_tags))
+        {
+            // carried tags can still be matched by the remaining old tags
+            spatial_grid_add(ld->grid, old_tags->c[i]);
+            candidate_table_remove(old_tags, i);
+            i--;
+        }
+    }
+}
 
-        for (int i = 0; i < zarray_size(new_tags); i++)
+static void associate_optimal(lightanchor_detector_t *ld, candidate_table_t *new_tags)
+{
+    candidate_table_t *old_tags = ld->candidates;
+
+    assignment_reset(ld->assignment, new_tags->size);
+
+    // one row per old tag, one arc per new tag that passes both thresholds
+    for (int i = 0; i < old_tags->size; i++)
+    {
+        assignment_add_row(ld->assignment);
+
+        zarray_t *neighbors = spatial_grid_query(ld->grid, old_tags->c[i]);
+        for (int k = 0; k < zarray_size(neighbors); k++)
         {
-            lightanchor_t *candidate_curr;
-            zarray_get(new_tags, i, &candidate_curr);
+            int j;
+            zarray_get(neighbors, k, &j);
 
-            uint8_t max, min, mean;
-            uint8_t brightness = extract_brightness(candidate_curr, im);
-            qb_add(&candidate_curr->brightnesses, brightness);
-            qb_stats(&candidate_curr->brightnesses, &max, &min, &mean);
+            double dist = g2d_distance(old_tags->c[i], new_tags->c[j]);
+            double dist_shape = fabs(new_tags->shape[j] - old_tags->shape[i]);
 
-            if (qb_full(&candidate_curr->brightnesses) && (max - min) > ld->range_thres)
+            if ((dist < ld->thres_dist_center) && (dist_shape < ld->thres_dist_shape))
             {
-                candidate_curr->code = (candidate_curr->code << 1) | (brightness > mean);
-                candidate_curr->frames = ld->ttl_frames;
+                assignment_add_arc(ld->assignment, j, dist / ld->thres_dist_center +
+                                                      dist_shape / ld->thres_dist_shape);
+            }
+        }
+    }
 
-                if (decode(ld, candidate_curr)) {
-                    lightanchor_t *det = lightanchor_copy(candidate_curr);
-                    zarray_add(detections, &det);
-                }
+    assignment_solve(ld->assignment);
+
+    for (int i = 0; i < old_tags->size; i++)
+    {
+        int j = ld->assignment->col_of_row[i];
+        if (j >= 0)
+            candidate_table_update(new_tags, j, old_tags, i);
+        else
+            keep_alive(ld, old_tags, i, new_tags);
+    }
+}
+
+static void add_event(lightanchor_detector_t *ld, int type, uint32_t id,
+                      candidate_table_t *t, int row, int detection)
+{
+    lightanchor_event_t event;
+    event.type = type;
+    event.id = id;
+    event.match_code = t->match_code[row];
+    memcpy(event.c, t->c[row], sizeof(event.c));
+    memcpy(event.p, t->p[row], sizeof(event.p));
+    event.detection = detection;
+    add_counted(ld->events, &event, &ld->nallocs);
+}
+
+static int id_compare(const void *_a, const void *_b)
+{
+    uint32_t a = *(const uint32_t *)_a, b = *(const uint32_t *)_b;
+    return (a > b) - (a < b);
+}
+
+/* old tags whose track was not passed on to a new tag; ids are unique, so a sorted list will do */
+static void lost_tracks(lightanchor_detector_t *ld, candidate_table_t *new_tags)
+{
+    candidate_table_t *old_tags = ld->candidates;
+
+    zarray_clear(ld->track_ids);
+    for (int j = 0; j < new_tags->size; j++)
+    {
+        if (new_tags->id[j] != 0)
+            add_counted(ld->track_ids, &new_tags->id[j], &ld->nallocs);
+    }
+    zarray_sort(ld->track_ids, id_compare);
+
+    for (int i = 0; i < old_tags->size; i++)
+    {
+        if (old_tags->id[i] != 0 &&
+            bsearch(&old_tags->id[i], ld->track_ids->data, zarray_size(ld->track_ids),
+                    sizeof(uint32_t), id_compare) == NULL)
+        {
+            add_event(ld, LIGHTANCHOR_LOST, old_tags->id[i], old_tags, i, -1);
+        }
+    }
+}
+
+/* make this frame's tags the new candidates, dropping the old ones */
+static void swap_candidates(lightanchor_detector_t *ld)
+{
+    candidate_table_clear(ld->candidates);
+
+    candidate_table_t *tmp = ld->candidates;
+    ld->candidates = ld->new_tags;
+    ld->new_tags = tmp;
+}
+
+static int task_chunksize(apriltag_detector_t *td, int n)
+{
+    return 1 + n / (TASKS_PER_THREAD_TARGET * td->nthreads);
+}
+
+static void add_result(struct candidate_task *task, int row, int type, uint32_t id)
+{
+    struct candidate_result result = { .row = row, .type = type, .id = id };
+    add_counted(task->results, &result, &task->nallocs);
+}
+
+/* samples candidates i0..i1 and keeps tracked ones on their phase, only reading ld->codes;
+   words that need a lookup are left for decode_candidates() */
+static void candidate_task(void *_u)
+{
+    struct candidate_task *task = (struct candidate_task *)_u;
+    lightanchor_detector_t *ld = task->ld;
+
+    zarray_clear(task->results);
+
+    candidate_table_t *t = task->new_tags;
+    for (int i = task->i0; i < task->i1; i++)
+    {
+        struct queue_buf *brightnesses = &t->brightnesses[i];
+
+        uint64_t t0 = task->stats ? stats_now_ns() : 0;
+
+        uint8_t max, min, mean;
+        uint8_t brightness = task->integral ?
+            quad_brightness_integral(t->p[i], ld->integral) :
+            quad_brightness(t->p[i], task->im);
+        qb_add(brightnesses, brightness);
+        qb_stats(brightnesses, &max, &min, &mean);
+
+        if (task->stats)
+            task->ns_brightness += stats_now_ns() - t0;
+
+        if (qb_full(brightnesses) && (max - min) > ld->range_thres)
+        {
+            t->frames[i] = ld->ttl_frames;
+
+            uint32_t id = t->id[i], match_code = t->match_code[i];
+            int tracked = t->valid[i] && id != 0;
+
+            uint64_t t1 = task->stats ? stats_now_ns() : 0;
+            int decoded = track_sample(ld, brightness > mean, &t->code[i], &t->next_code[i],
+                                       &t->valid[i], &t->nbits[i]);
+            if (task->stats)
+            {
+                task->ns_decode += stats_now_ns() - t1;
+                task->hits += decoded > 0;
+            }
+
+            // still reading its first word
+            if (decoded < 0)
+                continue;
+
+            if (decoded == 0)
+            {
+                add_result(task, i, RESULT_LOOKUP, tracked ? id : 0);
+                continue;
             }
+
+            if (tracked && t->match_code[i] == match_code)
+            {
+                add_result(task, i, LIGHTANCHOR_UPDATED, id);
+                continue;
+            }
+            t->id[i] = 0;
+            add_result(task, i, LIGHTANCHOR_ACQUIRED, 0);
         }
+    }
+}
 
-        lightanchors_destroy(ld->candidates);
-        ld->candidates = new_tags;
+/* adds the event of one candidate_task() result, and its detection unless the track was lost */
+static void add_result_event(lightanchor_detector_t *ld, candidate_table_t *new_tags,
+                             int row, int type, uint32_t id)
+{
+    if (type == LIGHTANCHOR_LOST)
+    {
+        add_event(ld, LIGHTANCHOR_LOST, id, new_tags, row, -1);
+        return;
     }
 
-    return detections;
+    if (type == LIGHTANCHOR_ACQUIRED)
+        new_tags->id[row] = ++ld->next_id;
+
+    lightanchor_t det;
+    candidate_table_get(new_tags, row, &det);
+    add_counted(ld->detection_arena, &det, &ld->nallocs);
+    add_event(ld, type, det.id, new_tags, row, zarray_size(ld->detection_arena) - 1);
 }
 
-zarray_t *decode_tags(apriltag_detector_t *td, lightanchor_detector_t *ld,
-                      zarray_t *quads, image_u8_t *im)
+/* the words candidate_task() left for lookup, as one match_codes() batch, in result order */
+static void lookup_words(lightanchor_detector_t *ld, candidate_table_t *new_tags, int ntasks)
 {
-    zarray_t *new_tags = zarray_create(sizeof(lightanchor_t *));
+    // at most one lookup per candidate
+    if (new_tags->size > ld->lookup_capacity)
+    {
+        ld->lookup_capacity = new_tags->size;
+        ld->lookup_words = realloc(ld->lookup_words, ld->lookup_capacity * sizeof(uint64_t));
+        ld->lookup_idx = realloc(ld->lookup_idx, ld->lookup_capacity * sizeof(int32_t));
+        ld->lookup_rot = realloc(ld->lookup_rot, ld->lookup_capacity * sizeof(uint8_t));
+        ld->nallocs++;
+    }
 
-    for (int i = 0; i < zarray_size(quads); i++)
+    int n = 0;
+    for (int i = 0; i < ntasks; i++)
+    {
+        struct candidate_task *task;
+        zarray_get_volatile(ld->candidate_tasks, i, &task);
+        for (int j = 0; j < zarray_size(task->results); j++)
+        {
+            struct candidate_result *result;
+            zarray_get_volatile(task->results, j, &result);
+            if (result->type == RESULT_LOOKUP)
+                ld->lookup_words[n++] = new_tags->code[result->row];
+        }
+    }
+
+    match_codes(ld, ld->lookup_words, n, ld->lookup_idx, ld->lookup_rot);
+}
+
+/* runs candidate_task() over new_tags on td->wp, then hands out ids and appends the
+   detections and events in candidate order */
+static void decode_candidates(apriltag_detector_t *td, lightanchor_detector_t *ld,
+                              candidate_table_t *new_tags, image_u8_t *im, int integral)
+{
+    int ncandidates = new_tags->size;
+    int chunksize = task_chunksize(td, ncandidates);
+    int ntasks = (ncandidates + chunksize - 1) / chunksize;
+
+    // task buffers are kept across frames so their storage is reused
+    while (zarray_size(ld->candidate_tasks) < ntasks)
+    {
+        struct candidate_task task;
+        memset(&task, 0, sizeof(struct candidate_task));
+        task.results = zarray_create(sizeof(struct candidate_result));
+        add_counted(ld->candidate_tasks, &task, &ld->nallocs);
+        ld->nallocs++;
+    }
+
+    for (int i = 0; i < ntasks; i++)
+    {
+        struct candidate_task *task;
+        zarray_get_volatile(ld->candidate_tasks, i, &task);
+        task->i0 = i * chunksize;
+        task->i1 = imin(ncandidates, task->i0 + chunksize);
+        task->ld = ld;
+        task->new_tags = new_tags;
+        task->im = im;
+        task->integral = integral;
+        task->stats = STATS_ENABLED(ld);
+        task->ns_brightness = task->ns_decode = 0;
+        task->hits = 0;
+        task->nallocs = 0;
+
+        workerpool_add_task(td->wp, candidate_task, task);
+    }
+
+    workerpool_run(td->wp);
+
+    // candidates that lost their phase or have none are looked up together, so
+    // wide codes get one hamming_scan() pass per word over the rotation table
+    uint64_t t0 = STATS_ENABLED(ld) ? stats_now_ns() : 0;
+    lookup_words(ld, new_tags, ntasks);
+    if (STATS_ENABLED(ld))
+        ld->stats.ns[STAGE_DECODE] += stats_now_ns() - t0;
+
+    int k = 0;
+    for (int i = 0; i < ntasks; i++)
+    {
+        struct candidate_task *task;
+        zarray_get_volatile(ld->candidate_tasks, i, &task);
+        ld->nallocs += task->nallocs;
+        if (task->stats)
+        {
+            ld->stats.ns[STAGE_BRIGHTNESS] += task->ns_brightness;
+            ld->stats.ns[STAGE_DECODE] += task->ns_decode;
+            ld->stats.counters[COUNTER_DECODE_HITS] += task->hits;
+        }
+        for (int j = 0; j < zarray_size(task->results); j++)
+        {
+            struct candidate_result *result;
+            zarray_get_volatile(task->results, j, &result);
+            int row = result->row;
+
+            if (result->type != RESULT_LOOKUP)
+            {
+                add_result_event(ld, new_tags, row, result->type, result->id);
+                continue;
+            }
+
+            // result->id is the track the candidate had, 0 if none
+            uint32_t match_code = new_tags->match_code[row];
+            int decoded = acquire_state(ld, ld->lookup_idx[k], ld->lookup_rot[k],
+                                        &new_tags->next_code[row], &new_tags->match_code[row],
+                                        &new_tags->valid[row]);
+            k++;
+            if (STATS_ENABLED(ld))
+            {
+                ld->stats.counters[COUNTER_DECODE_HITS] += decoded;
+                ld->stats.counters[COUNTER_DECODE_MISSES] += !decoded;
+            }
+
+            if (decoded && result->id != 0 && new_tags->match_code[row] == match_code)
+            {
+                add_result_event(ld, new_tags, row, LIGHTANCHOR_UPDATED, result->id);
+                continue;
+            }
+
+            // lost, or reacquired at another code, which is a different anchor
+            if (result->id != 0)
+                add_result_event(ld, new_tags, row, LIGHTANCHOR_LOST, result->id);
+            new_tags->id[row] = 0;
+            if (decoded)
+                add_result_event(ld, new_tags, row, LIGHTANCHOR_ACQUIRED, 0);
+        }
+    }
+}
+
+static zarray_t *update_candidates(apriltag_detector_t *td, lightanchor_detector_t *ld,
+                                   candidate_table_t *new_tags, image_u8_t *im)
+{
+    zarray_clear(ld->detection_arena);
+    zarray_clear(ld->detections);
+    zarray_clear(ld->events);
+
+    if (ld->candidates->size == 0)
+    {
+        swap_candidates(ld);
+    }
+    else {
+        uint64_t t0 = STATS_ENABLED(ld) ? stats_now_ns() : 0;
+
+        // only new tags within thres_dist_center of an old tag can match it;
+        // grid ids are rows of new_tags, carried tags are added to both in step
+        spatial_grid_reset(ld->grid, ld->thres_dist_center, new_tags->size);
+        for (int j = 0; j < new_tags->size; j++)
+            spatial_grid_add(ld->grid, new_tags->c[j]);
+
+        if (ld->association_mode == ASSOCIATION_OPTIMAL)
+            associate_optimal(ld, new_tags);
+        else
+            associate_greedy(ld, new_tags);
+
+        lost_tracks(ld, new_tags);
+
+        uint64_t t1 = STATS_ENABLED(ld) ? stats_now_ns() : 0;
+
+        int integral = use_integral_image(ld, new_tags, im);
+        if (integral)
+            integral_image_update(ld->integral, im);
+
+        if (STATS_ENABLED(ld))
+        {
+            uint64_t t2 = stats_now_ns();
+            ld->stats.ns[STAGE_ASSOCIATION] += t1 - t0;
+            ld->stats.ns[STAGE_BRIGHTNESS] += t2 - t1;
+        }
+
+        decode_candidates(td, ld, new_tags, im, integral);
+
+        swap_candidates(ld);
+    }
+
+    // the arena is done growing, so pointers into it stay valid
+    for (int i = 0; i < zarray_size(ld->detection_arena); i++)
+    {
+        lightanchor_t *det;
+        zarray_get_volatile(ld->detection_arena, i, &det);
+        add_counted(ld->detections, &det, &ld->nallocs);
+    }
+
+    return ld->detections;
+}
+
+/* refines and computes the homographies of quads i0..i1, each quad only touches itself */
+static void quad_task(void *_u)
+{
+    struct quad_task *task = (struct quad_task *)_u;
+
+    for (int i = task->i0; i < task->i1; i++)
     {
         struct quad *quad;
-        zarray_get_volatile(quads, i, &quad);
+        zarray_get_volatile(task->quads, i, &quad);
+
+        uint64_t t0 = task->stats ? stats_now_ns() : 0;
 
         // refine edges is not dependent upon the tag family, thus
         // apply this optimization BEFORE the other work.
-        if (td->refine_edges)
-            refine_edges(td, im, quad);
+        if (task->td->refine_edges)
+            refine_edges(task->td, task->im, quad);
+
+        uint64_t t1 = task->stats ? stats_now_ns() : 0;
 
         // make sure the homographies are computed...
+        // candidate_table_add_quad() skips the quad if they could not be
         if (quad_update_homographies(quad))
-            continue;
+        {
+            matd_destroy(quad->H);
+            quad->H = NULL;
+        }
+
+        if (task->stats)
+        {
+            task->ns_refine += t1 - t0;
+            task->ns_homography += stats_now_ns() - t1;
+        }
+    }
+}
+
+zarray_t *decode_tags(apriltag_detector_t *td, lightanchor_detector_t *ld,
+                      zarray_t *quads, image_u8_t *im)
+{
+    candidate_table_t *new_tags = ld->new_tags;
+
+    update_workerpool(td);
+
+    int nquads = zarray_size(quads);
+    int chunksize = task_chunksize(td, nquads);
+    int ntasks = (nquads + chunksize - 1) / chunksize;
+
+    uint64_t nallocs = ld->nallocs;
+    int grows = buffer_grows(ld);
+
+    // sized before any task is queued, the workers hold pointers into it
+    struct quad_task task;
+    memset(&task, 0, sizeof(struct quad_task));
+    while (zarray_size(ld->quad_tasks) < ntasks)
+        add_counted(ld->quad_tasks, &task, &ld->nallocs);
+
+    for (int i = 0; i < ntasks; i++)
+    {
+        struct quad_task *t;
+        zarray_get_volatile(ld->quad_tasks, i, &t);
+        t->i0 = i * chunksize;
+        t->i1 = imin(nquads, t->i0 + chunksize);
+        t->quads = quads;
+        t->td = td;
+        t->im = im;
+        t->stats = STATS_ENABLED(ld);
+        t->ns_refine = t->ns_homography = 0;
+
+        workerpool_add_task(td->wp, quad_task, t);
+    }
 
-        lightanchor_t *lightanchor;
-        if ((lightanchor = lightanchor_create(quad)) != NULL)
-            zarray_add(new_tags, &lightanchor);
+    workerpool_run(td->wp);
+
+    if (STATS_ENABLED(ld))
+    {
+        for (int i = 0; i < ntasks; i++)
+        {
+            struct quad_task *t;
+            zarray_get_volatile(ld->quad_tasks, i, &t);
+            ld->stats.ns[STAGE_REFINE_EDGES] += t->ns_refine;
+            ld->stats.ns[STAGE_HOMOGRAPHY] += t->ns_homography;
+        }
+    }
+
+    // rows are appended in quad order, which keeps the output deterministic
+    for (int i = 0; i < nquads; i++)
+    {
+        struct quad *quad;
+        zarray_get_volatile(quads, i, &quad);
+
+        int row = candidate_table_add_quad(new_tags, quad);
+        if (row >= 0)
+            qb_init(&new_tags->brightnesses[row], ld->brightness_window);
     }
     quads_destroy(quads);
 
-    // return new_tags;
-    return update_candidates(ld, new_tags, im);
+    zarray_t *detections = update_candidates(td, ld, new_tags, im);
+    ld->nallocs += buffer_grows(ld) - grows;
+
+    if (STATS_ENABLED(ld))
+    {
+        ld->stats.frames++;
+        ld->stats.counters[COUNTER_QUADS] += nquads;
+        ld->stats.counters[COUNTER_CANDIDATES] += ld->candidates->size;
+        ld->stats.counters[COUNTER_ALLOCATIONS] += ld->nallocs - nallocs;
+    }
+
+    return detections;
+}
+
+int decode_tags_into(apriltag_detector_t *td, lightanchor_detector_t *ld, zarray_t *quads,
+                     image_u8_t *im, lightanchor_detection_t *out, int capacity)
+{
+    decode_tags(td, ld, quads, im);
+    return lightanchor_detector_get_detections(ld, out, capacity);
 }
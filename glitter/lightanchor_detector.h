@@ -14,12 +14,92 @@
 #include "apriltag.h"
 #include "common/zarray.h"
 
+#include "integral_image.h"
+#include "spatial_grid.h"
+#include "assignment.h"
+#include "lightanchor.h"
+#include "candidate_table.h"
+#include "detector_stats.h"
+
+// code widths lightanchor_detector_set_code_width() accepts
+#define CODE_WIDTH_DEFAULT      8
+#define CODE_WIDTH_MAX          32
+
+// widest codes matched through a lookup table of all 2^width sequences
+#define CODE_LUT_MAX_WIDTH      12
+
 /* declare functions that we need as extern */
 extern zarray_t *apriltag_quad_thresh(apriltag_detector_t *td, image_u8_t *im);
 extern int quad_update_homographies(struct quad *quad);
 extern struct quad *quad_copy(struct quad *quad);
 extern int quads_destroy(zarray_t *quads);
 
+/* how candidate brightness is sampled every frame */
+enum brightness_mode
+{
+    // pick BRIGHTNESS_INTEGRAL once candidates cover enough of the frame
+    BRIGHTNESS_AUTO = 0,
+    // sum each quad's pixels row by row
+    BRIGHTNESS_SCANLINE,
+    // build an integral image of the frame once and look up row spans
+    BRIGHTNESS_INTEGRAL,
+};
+
+/* how old candidates are matched to the tags of a new frame */
+enum association_mode
+{
+    // every old candidate takes its closest new tag, first come first served
+    ASSOCIATION_GREEDY = 0,
+    // minimum total center + shape distance over all gated pairs
+    ASSOCIATION_OPTIMAL,
+};
+
+/* what happened to a track during the last frame */
+enum lightanchor_event_type
+{
+    // a candidate decoded for the first time, or again after it was lost; it gets a new id
+    LIGHTANCHOR_ACQUIRED = 0,
+    // a tracked candidate decoded again
+    LIGHTANCHOR_UPDATED,
+    // the candidate stopped decoding, switched codes, or could not be associated any more
+    LIGHTANCHOR_LOST,
+};
+
+typedef struct lightanchor_event lightanchor_event_t;
+struct lightanchor_event
+{
+    // see enum lightanchor_event_type
+    int type;
+
+    // track id, ids are handed out in increasing order starting at 1 and never reused
+    uint32_t id;
+    uint32_t match_code;
+
+    // last known position
+    double c[2];
+    double p[4][2];
+
+    // index into the detections returned by decode_tags(), -1 for LIGHTANCHOR_LOST
+    int detection;
+};
+
+/* plain copy of a detection, for lightanchor_detector_get_detections() */
+typedef struct lightanchor_detection lightanchor_detection_t;
+struct lightanchor_detection
+{
+    uint32_t id;
+    uint32_t match_code;
+
+    // LIGHTANCHOR_ACQUIRED or LIGHTANCHOR_UPDATED
+    int state;
+
+    double c[2];
+    double p[4][2];
+
+    // homography, row major
+    double H[9];
+};
+
 typedef struct lightanchor_detector lightanchor_detector_t;
 struct lightanchor_detector
 {
@@ -38,13 +118,211 @@ struct lightanchor_detector
     // threshold for center difference between frames
     double thres_dist_center;
 
+    // number of frames of brightness history per candidate, at most QB_MAX_SIZE
+    int brightness_window;
+
+    // see enum association_mode
+    int association_mode;
+
+    // see enum brightness_mode
+    int brightness_mode;
+
+    // in BRIGHTNESS_AUTO, switch to the integral image once the summed candidate
+    // area exceeds this fraction of the frame area
+    double integral_area_frac;
+
     zarray_t *codes;
-    zarray_t *candidates;
+
+    // tracked candidates, as of the last frame
+    candidate_table_t *candidates;
+
+    // bit errors tolerated when matching an observed sequence to a code
+    int max_hamming;
+
+    // bits per code, see lightanchor_detector_set_code_width()
+    int code_width;
+
+    // up to CODE_LUT_MAX_WIDTH: for every sequence of code_width bits, the closest code
+    // at any rotation (index into codes, -1 if none yet), its distance and the rotation;
+    // NULL for wider codes, which use code_index sorted by canonical rotation instead
+    int16_t *code_lut;
+    uint8_t *code_lut_dist;
+    uint8_t *code_lut_rot;
+    zarray_t *code_index;
+
+    // wider codes with max_hamming > 0: every rotation of every code (uint32_t),
+    // rotation r of code i at i*code_width + r, scanned by hamming_scan()
+    zarray_t *code_rotations;
+
+    // this frame's tags, swapped with candidates once they are updated
+    candidate_table_t *new_tags;
+
+    // last track id handed out, ids start at 1
+    uint32_t next_id;
+
+    // lightanchor_event_t of the last frame, and scratch for finding lost tracks
+    zarray_t *events;
+    zarray_t *track_ids;
+
+    // per-frame detections: copies by value, plus the pointer array returned by decode_tags()
+    zarray_t *detection_arena;
+    zarray_t *detections;
+
+    // chunks of the parallel refinement/homography stage, grown to the largest frame so far
+    zarray_t *quad_tasks;
+
+    // per-task detection buffers of the parallel brightness/decode stage
+    zarray_t *candidate_tasks;
+
+    // words of the candidates that decode_candidates() looks up in one match_codes()
+    // batch, and the codes and rotations found; room for lookup_capacity candidates
+    uint64_t *lookup_words;
+    int32_t *lookup_idx;
+    uint8_t *lookup_rot;
+    int lookup_capacity;
+
+    // scratch copy of the frame for detect_quads_scratch(), reused while the size stays the same
+    image_u8_t *quad_im;
+
+    // detect_quads_tracked(): once anchors are decoded, only threshold padded
+    // regions around the predicted positions of the candidates
+    int track_roi;
+
+    // ...but still scan the full frame at least every roi_full_every frames
+    int roi_full_every;
+
+    // padding around each predicted quad, in pixels
+    int roi_pad;
+
+    // frames since the last full scan, and decoded tracks when the last frame started
+    int roi_frames;
+    int roi_tracks;
+
+    // merged regions of the current frame as {x0, y0, x1, y1}, and their pixels
+    zarray_t *rois;
+    uint8_t *roi_buf;
+    int roi_buf_size;
+
+    integral_image_t *integral;
+
+    // new tags bucketed by center, cells are thres_dist_center wide
+    spatial_grid_t *grid;
+
+    // cost matrix and solver state for ASSOCIATION_OPTIMAL
+    assignment_t *assignment;
+
+    // accumulate stats while set; building with -DGLITTER_NO_STATS compiles them out
+    int collect_stats;
+    detector_stats_t stats;
+
+    // heap allocations made while processing frames: growth of the candidate tables,
+    // per-frame arrays, integral image, grid and solver, task buffers and scratch
+    // frames; counted whether or not stats are collected, for tests and benchmarks
+    uint64_t nallocs;
 };
 
 lightanchor_detector_t *lightanchor_detector_create();
-int lightanchor_detector_add_code(lightanchor_detector_t *ld, char code);
+/**
+ * Register a code to look for. Codes are matched at any cyclic phase, so a code
+ * that is a rotation of one already registered cannot be told apart from it.
+ *
+ * @return 0 on success, -1 if the code is a rotation of a registered one
+ */
+int lightanchor_detector_add_code(lightanchor_detector_t *ld, uint32_t code);
+
+/**
+ * Set the number of bits per code: 8, 12, 16, 24 or 32. This drops the registered
+ * codes, so call it before lightanchor_detector_add_code(). The brightness window
+ * becomes 2*width frames, since each bit is seen in two frames.
+ *
+ * @return 0 on success, -1 for an unsupported width
+ */
+int lightanchor_detector_set_code_width(lightanchor_detector_t *ld, int width);
+
+/**
+ * Track quads across frames and decode the blinking ones.
+ *
+ * The returned array of (lightanchor_t *) is owned by the detector and is only
+ * valid until the next call to decode_tags() or lightanchor_detector_destroy().
+ * Use lightanchor_copy() to keep a detection for longer.
+ *
+ * This is an API change: the array used to be handed over to the caller, to be
+ * freed with lightanchors_destroy(). Callers must no longer free it, or any of
+ * the detections in it.
+ *
+ * Per-quad and per-candidate work runs on td->nthreads threads, the detections
+ * come out in the same order for any thread count.
+ *
+ * Every detection carries the id of its track in lightanchor_t.id, which stays the
+ * same from frame to frame while the anchor keeps being followed. See
+ * lightanchor_detector_events() for when tracks start and end.
+ *
+ * @param *td an initialized apriltag detector
+ * @param *ld an initialized lightanchor detector
+ * @param *quads z_array of struct quad from detect_quads(), freed by this call
+ * @param *im grayscale image the quads were detected in
+ *
+ * @return z_array of (lightanchor_t *) that decoded this frame
+ */
 zarray_t *decode_tags(apriltag_detector_t *td, lightanchor_detector_t *ld, zarray_t *quads, image_u8_t *im);
+
+/**
+ * Track events of the last decode_tags() call, as (lightanchor_event_t).
+ *
+ * One LIGHTANCHOR_ACQUIRED or LIGHTANCHOR_UPDATED event per detection, plus a
+ * LIGHTANCHOR_LOST event for every track that ended, so callers can follow
+ * anchors by id without matching positions across frames themselves. Tracks
+ * lost during association come first, then the events of the candidates in
+ * the same order as the detections. A candidate that switches codes reports
+ * LIGHTANCHOR_LOST for its old id before LIGHTANCHOR_ACQUIRED for the new one.
+ *
+ * The array is owned by the detector and rewritten by the next decode_tags().
+ *
+ * @param *ld an initialized lightanchor detector
+ *
+ * @return z_array of lightanchor_event_t
+ */
+zarray_t *lightanchor_detector_events(lightanchor_detector_t *ld);
+
+/**
+ * Copy the stage timings and counters accumulated since the detector was created
+ * or lightanchor_detector_reset_stats() was last called.
+ *
+ * Nothing is collected unless ld->collect_stats is set, and builds with
+ * -DGLITTER_NO_STATS (make GLITTER_STATS=0) leave out the measuring code
+ * altogether. Stages timed in detect_quads_tracked() only count when it is the
+ * one finding the quads.
+ *
+ * @param *ld an initialized lightanchor detector
+ * @param *out stats to write
+ */
+void lightanchor_detector_get_stats(lightanchor_detector_t *ld, detector_stats_t *out);
+
+/** Zero the stats of lightanchor_detector_get_stats(). */
+void lightanchor_detector_reset_stats(lightanchor_detector_t *ld);
+
+/**
+ * Copy the detections of the last decode_tags() call into a caller-owned array,
+ * in the same order. Nothing is allocated, so out can live on the stack or in a
+ * buffer shared with another runtime.
+ *
+ * @param *ld an initialized lightanchor detector
+ * @param *out array of at least capacity records
+ * @param capacity number of records out can hold
+ *
+ * @return number of detections; if that is more than capacity, only the first
+ *         capacity were written
+ */
+int lightanchor_detector_get_detections(lightanchor_detector_t *ld,
+                                        lightanchor_detection_t *out, int capacity);
+
+/**
+ * decode_tags() followed by lightanchor_detector_get_detections().
+ *
+ * @return number of detections, see lightanchor_detector_get_detections()
+ */
+int decode_tags_into(apriltag_detector_t *td, lightanchor_detector_t *ld, zarray_t *quads,
+                     image_u8_t *im, lightanchor_detection_t *out, int capacity);
 void lightanchor_detector_destroy(lightanchor_detector_t *ld);
 
 apriltag_family_t *lightanchor_family_create();
@@ -65,6 +343,45 @@ apriltag_family_t *lightanchor_family_create();
  */
 zarray_t *detect_quads(apriltag_detector_t *td, image_u8_t *im_orig);
 
+/**
+ * Same as detect_quads(), without allocating a copy of the image every frame.
+ *
+ * Quad thresholding may modify the image it runs on. If scratch is NULL the
+ * caller declares im_orig mutable and it is used directly. Otherwise im_orig
+ * is copied into *scratch, which is (re)allocated only when the image size
+ * changes; pass &ld->quad_im to let the lightanchor detector own it.
+ *
+ * Caller *must free* returned array with quads_destroy()
+ *
+ * @param *td an initialized apriltag detector
+ * @param *im_orig grayscale image to perform the detection on
+ * @param **scratch persistent scratch image, or NULL
+ *
+ * @return z_array of struct quad
+ */
+zarray_t *detect_quads_scratch(apriltag_detector_t *td, image_u8_t *im_orig, image_u8_t **scratch);
+
+/**
+ * Quad detection that follows decoded anchors when ld->track_roi is set.
+ *
+ * Regions around the predicted positions of all live candidates, decoded or
+ * still being sampled, are thresholded on their own and the quads are shifted
+ * back into frame coordinates. The full frame is scanned instead when nothing is
+ * decoded yet, when a decoded track was lost during the last frame, or every
+ * ld->roi_full_every frames. Quads that appear away from any candidate are only
+ * found by those full scans; once they are candidates they get regions of
+ * their own until they decode or age out.
+ *
+ * Caller *must free* returned array with quads_destroy()
+ *
+ * @param *td an initialized apriltag detector
+ * @param *ld the lightanchor detector the quads will be passed to
+ * @param *im grayscale image to perform the detection on
+ *
+ * @return z_array of struct quad
+ */
+zarray_t *detect_quads_tracked(apriltag_detector_t *td, lightanchor_detector_t *ld, image_u8_t *im);
+
 
 /**
  * Free an array of quads
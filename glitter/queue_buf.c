@@ -3,35 +3,83 @@
 
 #include "queue_buf.h"
 
+#define Q_MASK  (QB_MAX_SIZE - 1)
+
+void qb_init(struct queue_buf *qb, int size) {
+    memset(qb, 0, sizeof(struct queue_buf));
+    if (size < 1) size = 1;
+    if (size > QB_MAX_SIZE) size = QB_MAX_SIZE;
+    qb->size = size;
+}
+
+int qb_size(struct queue_buf *qb) {
+    return qb->size ? qb->size : QB_DEFAULT_SIZE;
+}
+
 int qb_full(struct queue_buf *qb) {
-    return qb->full;
+    return qb->count == qb_size(qb);
 }
 
+/* drop the front of a deque if it is the slot about to be overwritten */
+static inline void deque_expire(uint8_t *q, uint8_t *head, uint8_t *len, int slot) {
+    if (*len && q[*head] == slot) {
+        *head = (*head + 1) & Q_MASK;
+        (*len)--;
+    }
+}
+
+/** Adds a sample, returns the one that fell out of the window (0 while filling up). */
 uint8_t qb_add(struct queue_buf *qb, uint8_t in) {
-    uint8_t res = qb->buf[qb->idx];
+    int size = qb_size(qb);
+    uint8_t res = 0;
+
+    if (qb->count == size) {
+        res = qb->buf[qb->idx];
+        qb->sum -= res;
+        deque_expire(qb->max_q, &qb->max_head, &qb->max_len, qb->idx);
+        deque_expire(qb->min_q, &qb->min_head, &qb->min_len, qb->idx);
+    }
+    else {
+        qb->count++;
+    }
+
     qb->buf[qb->idx] = in;
+    qb->sum += in;
+
+    // older samples that can no longer be the max/min leave from the back
+    while (qb->max_len && qb->buf[qb->max_q[(qb->max_head + qb->max_len - 1) & Q_MASK]] <= in)
+        qb->max_len--;
+    qb->max_q[(qb->max_head + qb->max_len++) & Q_MASK] = qb->idx;
+
+    while (qb->min_len && qb->buf[qb->min_q[(qb->min_head + qb->min_len - 1) & Q_MASK]] >= in)
+        qb->min_len--;
+    qb->min_q[(qb->min_head + qb->min_len++) & Q_MASK] = qb->idx;
+
     qb->idx++;
-    if (qb->idx == BUF_SIZE) {
-        qb->full = 1;
+    if (qb->idx == size) {
         qb->idx = 0;
     }
     return res;
 }
 
+/** i-th sample in the window, oldest first. */
+uint8_t qb_get(struct queue_buf *qb, int i) {
+    int size = qb_size(qb);
+    return qb->buf[(qb->idx - qb->count + i + 2*size) % size];
+}
+
+/** Max, min and mean of the samples in the window, all 0 if it is empty. */
 void qb_stats(struct queue_buf *qb, uint8_t *max, uint8_t *min, uint8_t *avg) {
-    if (max) *max = 0;
-    if (min) *min = 255;
-    int sum = 0;
-    for (int i = 0; i < BUF_SIZE; i++)
-    {
-        uint8_t val = qb->buf[i];
-        if (max) *max = (val > *max) ? val : *max;
-        if (min) *min = (val < *min) ? val : *min;
-        if (avg) sum += val;
+    if (qb->count == 0) {
+        if (max) *max = 0;
+        if (min) *min = 0;
+        if (avg) *avg = 0;
+        return;
     }
-    if (max) *max = (*max != 0) ? *max : 255;
-    if (min) *min = (*min != 255) ? *min : 0;
-    if (avg) *avg = sum / BUF_SIZE;
+
+    if (max) *max = qb->buf[qb->max_q[qb->max_head]];
+    if (min) *min = qb->buf[qb->min_q[qb->min_head]];
+    if (avg) *avg = qb->sum / qb->count;
 }
 
 void qb_copy(struct queue_buf *src, struct queue_buf *dest) {
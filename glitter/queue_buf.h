@@ -1,16 +1,35 @@
 #ifndef _QUEUE_BUF_H_
 #define _QUEUE_BUF_H_
 
-#define BUF_SIZE    16
+#include <stdint.h>
 
+// window length used when none was given to qb_init()
+#define QB_DEFAULT_SIZE 16
+
+// longest supported window, must be a power of two
+#define QB_MAX_SIZE     64
+
+/**
+ * Sliding window of the last `size` samples.
+ * The sum and two monotonic deques (slots into buf, oldest first) are kept up to
+ * date by qb_add(), so qb_stats() is O(1).
+ */
 struct queue_buf {
-    int idx;
-    int full;
-    uint8_t buf[BUF_SIZE];
+    int size;   // 0 means QB_DEFAULT_SIZE, so a zeroed queue_buf is usable
+    int count;  // samples currently in the window
+    int idx;    // slot the next sample goes to
+    int sum;
+    uint8_t buf[QB_MAX_SIZE];
+
+    uint8_t max_q[QB_MAX_SIZE], min_q[QB_MAX_SIZE];
+    uint8_t max_head, max_len, min_head, min_len;
 };
 
+void qb_init(struct queue_buf *qb, int size);
+int qb_size(struct queue_buf *qb);
 int qb_full(struct queue_buf *qb);
 uint8_t qb_add(struct queue_buf *qb, uint8_t in);
+uint8_t qb_get(struct queue_buf *qb, int i);
 void qb_stats(struct queue_buf *qb, uint8_t *max, uint8_t *min, uint8_t *avg);
 void qb_copy(struct queue_buf *src, struct queue_buf *dest);
 
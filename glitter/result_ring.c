@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "result_ring.h"
+#include "lightanchor_detector.h"
+
+result_ring_t *result_ring_create(int nslots, int capacity)
+{
+    result_ring_t *ring = calloc(1, sizeof(result_ring_t));
+    ring->nslots = nslots;
+    ring->capacity = capacity;
+    // both int32 parts are a multiple of 16 bytes, so the float64 part stays aligned
+    ring->slot_size = (RESULT_HEADER_INTS + capacity * RESULT_INTS) * sizeof(int32_t) +
+                      capacity * RESULT_DOUBLES * sizeof(double);
+    ring->head = -1;
+    ring->buf = calloc(nslots, ring->slot_size);
+    return ring;
+}
+
+int32_t *result_ring_ints(result_ring_t *ring, int32_t *slot)
+{
+    return slot + RESULT_HEADER_INTS;
+}
+
+double *result_ring_doubles(result_ring_t *ring, int32_t *slot)
+{
+    return (double *)(slot + RESULT_HEADER_INTS + ring->capacity * RESULT_INTS);
+}
+
+int32_t *result_ring_latest(result_ring_t *ring)
+{
+    if (ring->head < 0)
+        return NULL;
+    return (int32_t *)(ring->buf + ring->head * ring->slot_size);
+}
+
+static inline double undecimate(double v, double decimate)
+{
+    return (v - 0.5) * decimate + 0.5;
+}
+
+static void write_record(int32_t *ints, double *doubles, lightanchor_event_t *ev, double decimate)
+{
+    ints[RESULT_ID] = ev->id;
+    ints[RESULT_CODE] = ev->match_code;
+    ints[RESULT_STATE] = ev->type;
+    ints[RESULT_STATE + 1] = 0;   // unused, keeps records 16 bytes
+
+    if (decimate > 1)
+    {
+        doubles[RESULT_CX] = undecimate(ev->c[0], decimate);
+        doubles[RESULT_CY] = undecimate(ev->c[1], decimate);
+        for (int j = 0; j < 4; j++)
+        {
+            doubles[RESULT_P + 2*j] = undecimate(ev->p[j][0], decimate);
+            doubles[RESULT_P + 2*j + 1] = undecimate(ev->p[j][1], decimate);
+        }
+    }
+    else {
+        doubles[RESULT_CX] = ev->c[0];
+        doubles[RESULT_CY] = ev->c[1];
+        memcpy(&doubles[RESULT_P], ev->p, sizeof(ev->p));
+    }
+}
+
+int32_t *result_ring_write(result_ring_t *ring, zarray_t *events, double decimate)
+{
+    ring->head = (ring->head + 1) % ring->nslots;
+    int32_t *slot = (int32_t *)(ring->buf + ring->head * ring->slot_size);
+    int32_t *ints = result_ring_ints(ring, slot);
+    double *doubles = result_ring_doubles(ring, slot);
+
+    int n = 0, ndetections = 0, nlost = 0, ndropped = 0;
+
+    // detections first, in the order decode_tags() returned them, then the lost tracks
+    for (int lost = 0; lost <= 1; lost++)
+    {
+        for (int i = 0; i < zarray_size(events); i++)
+        {
+            lightanchor_event_t *ev;
+            zarray_get_volatile(events, i, &ev);
+            if ((ev->type == LIGHTANCHOR_LOST) != lost)
+                continue;
+
+            if (n == ring->capacity)
+            {
+                ndropped++;
+                continue;
+            }
+
+            write_record(&ints[n * RESULT_INTS], &doubles[n * RESULT_DOUBLES], ev, decimate);
+            n++;
+            if (lost)
+                nlost++;
+            else
+                ndetections++;
+        }
+    }
+
+    slot[RESULT_FRAME] = ring->frame++;
+    slot[RESULT_NDETECTIONS] = ndetections;
+    slot[RESULT_NLOST] = nlost;
+    slot[RESULT_NDROPPED] = ndropped;
+    return slot;
+}
+
+void result_ring_destroy(result_ring_t *ring)
+{
+    if (ring == NULL)
+        return;
+
+    free(ring->buf);
+    free(ring);
+}
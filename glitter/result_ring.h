@@ -0,0 +1,76 @@
+#ifndef _RESULT_RING_H_
+#define _RESULT_RING_H_
+
+#include <stdint.h>
+
+#include "common/zarray.h"
+
+// int32 header of a slot
+#define RESULT_FRAME            0
+#define RESULT_NDETECTIONS      1
+#define RESULT_NLOST            2
+// events that did not fit in the slot
+#define RESULT_NDROPPED         3
+#define RESULT_HEADER_INTS      4
+
+// int32 fields of a record
+#define RESULT_ID               0
+#define RESULT_CODE             1
+#define RESULT_STATE            2
+#define RESULT_INTS             4
+
+// float64 fields of a record: center, then the four corners
+#define RESULT_CX               0
+#define RESULT_CY               1
+#define RESULT_P                2
+#define RESULT_DOUBLES          10
+
+/**
+ * Per-frame results packed into flat int32/float64 arrays, so another runtime
+ * (the wasm worker) can read them in place instead of being handed one object
+ * per detection.
+ *
+ * A slot is the int32 header, capacity int32 records and capacity float64
+ * records, in that order and without padding. Records are the frame's
+ * detections in decode_tags() order, followed by the tracks lost that frame.
+ * Frames go to consecutive slots, so the last nslots frames stay readable.
+ */
+typedef struct result_ring result_ring_t;
+struct result_ring
+{
+    int nslots;
+
+    // records per slot
+    int capacity;
+
+    // bytes per slot, a multiple of 8
+    int slot_size;
+
+    // slot of the last frame, -1 before the first
+    int head;
+    int frame;
+
+    uint8_t *buf;
+};
+
+result_ring_t *result_ring_create(int nslots, int capacity);
+
+/**
+ * Pack a frame's events from lightanchor_detector_events() into the next slot.
+ * Coordinates are scaled back from a frame decimated by `decimate`, pass 1 if
+ * the quads were found at full resolution.
+ *
+ * @return the header of the slot
+ */
+int32_t *result_ring_write(result_ring_t *ring, zarray_t *events, double decimate);
+
+/** Header of the last frame's slot, NULL before the first frame. */
+int32_t *result_ring_latest(result_ring_t *ring);
+
+/** int32 and float64 records of a slot. */
+int32_t *result_ring_ints(result_ring_t *ring, int32_t *slot);
+double *result_ring_doubles(result_ring_t *ring, int32_t *slot);
+
+void result_ring_destroy(result_ring_t *ring);
+
+#endif
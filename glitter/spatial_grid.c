@@ -0,0 +1,114 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "spatial_grid.h"
+
+static inline int cell_coord(spatial_grid_t *grid, double v)
+{
+    return (int)floor(v / grid->cell_size);
+}
+
+static inline int bucket(spatial_grid_t *grid, int cx, int cy)
+{
+    return ((unsigned)cx * 73856093u ^ (unsigned)cy * 19349663u) & (grid->nbuckets - 1);
+}
+
+spatial_grid_t *spatial_grid_create()
+{
+    spatial_grid_t *grid = calloc(1, sizeof(spatial_grid_t));
+    grid->result = zarray_create(sizeof(int));
+    return grid;
+}
+
+void spatial_grid_reset(spatial_grid_t *grid, double cell_size, int size_hint)
+{
+    // nothing can be closer than a non-positive threshold, any cell size will do
+    grid->cell_size = (cell_size > 0) ? cell_size : 1;
+    grid->size = 0;
+
+    int nbuckets = 16;
+    while (nbuckets < 2*size_hint)
+        nbuckets *= 2;
+
+    if (nbuckets > grid->nbuckets)
+    {
+        free(grid->heads);
+        grid->heads = malloc(nbuckets * sizeof(int));
+        grid->nbuckets = nbuckets;
+        grid->grows++;
+    }
+
+    for (int i = 0; i < grid->nbuckets; i++)
+        grid->heads[i] = -1;
+}
+
+int spatial_grid_add(spatial_grid_t *grid, const double p[2])
+{
+    if (grid->size == grid->capacity)
+    {
+        grid->capacity = (grid->capacity > 0) ? 2*grid->capacity : 64;
+        grid->next = realloc(grid->next, grid->capacity * sizeof(int));
+        grid->cells = realloc(grid->cells, grid->capacity * sizeof(int[2]));
+        grid->grows++;
+    }
+
+    int id = grid->size++;
+    int cx = cell_coord(grid, p[0]), cy = cell_coord(grid, p[1]);
+    int b = bucket(grid, cx, cy);
+
+    grid->cells[id][0] = cx;
+    grid->cells[id][1] = cy;
+    grid->next[id] = grid->heads[b];
+    grid->heads[b] = id;
+
+    return id;
+}
+
+zarray_t *spatial_grid_query(spatial_grid_t *grid, const double p[2])
+{
+    zarray_clear(grid->result);
+
+    int cx = cell_coord(grid, p[0]), cy = cell_coord(grid, p[1]);
+
+    for (int dy = -1; dy <= 1; dy++)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            int b = bucket(grid, cx + dx, cy + dy);
+            // buckets are shared between cells, only take points of this cell
+            for (int id = grid->heads[b]; id >= 0; id = grid->next[id])
+            {
+                if (grid->cells[id][0] == cx + dx && grid->cells[id][1] == cy + dy)
+                {
+                    int alloc = grid->result->alloc;
+                    zarray_add(grid->result, &id);
+                    grid->grows += grid->result->alloc != alloc;
+                }
+            }
+        }
+    }
+
+    // callers rely on points coming back in the order they were added
+    int *ids = (int *)grid->result->data;
+    for (int i = 1; i < zarray_size(grid->result); i++)
+    {
+        int id = ids[i], j = i - 1;
+        for (; j >= 0 && ids[j] > id; j--)
+            ids[j + 1] = ids[j];
+        ids[j + 1] = id;
+    }
+
+    return grid->result;
+}
+
+void spatial_grid_destroy(spatial_grid_t *grid)
+{
+    if (grid == NULL)
+        return;
+
+    free(grid->heads);
+    free(grid->next);
+    free(grid->cells);
+    zarray_destroy(grid->result);
+    free(grid);
+}
@@ -0,0 +1,39 @@
+#ifndef _SPATIAL_GRID_H_
+#define _SPATIAL_GRID_H_
+
+#include "common/zarray.h"
+
+/**
+ * Uniform grid over 2D points, hashed into a power-of-two bucket table.
+ * Points are identified by the order they were added in (0, 1, 2, ...).
+ * With cell_size equal to a distance threshold, every point within that
+ * distance of a query lies in the 3x3 cells around it.
+ */
+typedef struct spatial_grid spatial_grid_t;
+struct spatial_grid
+{
+    double cell_size;
+
+    int nbuckets;
+    int *heads;
+
+    // per point: next point in the same bucket, and its cell
+    int size;
+    int capacity;
+    int *next;
+    int (*cells)[2];
+
+    // ids returned by the last query, ascending
+    zarray_t *result;
+
+    // times one of the buffers above was reallocated to a larger capacity
+    int grows;
+};
+
+spatial_grid_t *spatial_grid_create();
+void spatial_grid_reset(spatial_grid_t *grid, double cell_size, int size_hint);
+int spatial_grid_add(spatial_grid_t *grid, const double p[2]);
+zarray_t *spatial_grid_query(spatial_grid_t *grid, const double p[2]);
+void spatial_grid_destroy(spatial_grid_t *grid);
+
+#endif
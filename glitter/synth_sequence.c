@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common/math_util.h"
+
+#include "synth_sequence.h"
+#include "spatial_grid.h"
+
+void synth_params_init(synth_params_t *params)
+{
+    memset(params, 0, sizeof(synth_params_t));
+    params->width = 1280;
+    params->height = 720;
+    params->nanchors = 40;
+    params->size = 24;
+    params->background = 10;
+    params->off = 90;
+    params->on = 250;
+    params->frames_per_bit = 2;
+    params->seed = 1;
+}
+
+/* splitmix64, so sequences do not depend on the C library's random() */
+static uint64_t next_u64(synth_sequence_t *seq)
+{
+    uint64_t z = (seq->rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* uniform in [0, 1) */
+static double next_double(synth_sequence_t *seq)
+{
+    return (next_u64(seq) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static double next_gaussian(synth_sequence_t *seq)
+{
+    double u = 1.0 - next_double(seq), v = next_double(seq);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+synth_sequence_t *synth_sequence_create(const synth_params_t *params,
+                                        const uint32_t *codes, int ncodes, int code_width)
+{
+    synth_sequence_t *seq = calloc(1, sizeof(synth_sequence_t));
+    seq->params = *params;
+    seq->code_width = code_width;
+    seq->rng = params->seed;
+    seq->nanchors = params->nanchors;
+    seq->anchors = calloc(imax(1, params->nanchors), sizeof(synth_anchor_t));
+    seq->scratch = malloc(params->width * params->height);
+
+    // anchors no closer than their circumscribed circles allow, unless the frame is too crowded
+    double max_size = params->size * (1 + params->size_jitter);
+    spatial_grid_t *grid = spatial_grid_create();
+    spatial_grid_reset(grid, sqrt(2) * max_size + 2, params->nanchors);
+
+    for (int i = 0; i < seq->nanchors; i++)
+    {
+        synth_anchor_t *a = &seq->anchors[i];
+        a->code = codes[next_u64(seq) % ncodes];
+        a->size = params->size * (1 + params->size_jitter * (2 * next_double(seq) - 1));
+        a->phase = next_u64(seq) % (int)ceil(code_width * params->frames_per_bit);
+        a->theta = next_double(seq) * M_PI / 2;
+        a->omega = params->spin * (next_double(seq) < 0.5 ? -1 : 1);
+
+        double dir = next_double(seq) * 2 * M_PI;
+        a->v[0] = params->speed * cos(dir);
+        a->v[1] = params->speed * sin(dir);
+
+        for (int tries = 0; tries < 64; tries++)
+        {
+            a->c[0] = a->size + next_double(seq) * (params->width - 2 * a->size);
+            a->c[1] = a->size + next_double(seq) * (params->height - 2 * a->size);
+
+            int clear = 1;
+            zarray_t *near = spatial_grid_query(grid, a->c);
+            for (int j = 0; j < zarray_size(near) && clear; j++)
+            {
+                int id;
+                zarray_get(near, j, &id);
+                synth_anchor_t *b = &seq->anchors[id];
+                double dx = a->c[0] - b->c[0], dy = a->c[1] - b->c[1];
+                clear = sqrt(dx*dx + dy*dy) >= (a->size + b->size) / sqrt(2) + 2;
+            }
+            if (clear)
+                break;
+        }
+        spatial_grid_add(grid, a->c);
+    }
+
+    spatial_grid_destroy(grid);
+    return seq;
+}
+
+/* fraction of frame f's exposure during which the anchor's LED is on */
+static double exposure(synth_sequence_t *seq, synth_anchor_t *a, int f)
+{
+    double frames_per_bit = seq->params.frames_per_bit;
+    int width = seq->code_width;
+
+    double lit = 0, t = f + a->phase, end = t + 1;
+    while (t < end)
+    {
+        double bit = floor(t / frames_per_bit);
+        double next = fmin(end, (bit + 1) * frames_per_bit);
+        if (next <= t)
+            break;
+
+        int b = (int)fmod(bit, width);
+        if ((a->code >> (width - 1 - b)) & 1)
+            lit += next - t;
+        t = next;
+    }
+    return lit;
+}
+
+/* pixels whose centers are inside the convex quad p */
+static void fill_quad(image_u8_t *im, double p[4][2], uint8_t value)
+{
+    double min[2] = { p[0][0], p[0][1] }, max[2] = { p[0][0], p[0][1] };
+    for (int j = 1; j < 4; j++)
+    {
+        for (int k = 0; k < 2; k++)
+        {
+            min[k] = fmin(min[k], p[j][k]);
+            max[k] = fmax(max[k], p[j][k]);
+        }
+    }
+
+    int x0 = imax(0, (int)floor(min[0])), x1 = imin(im->width - 1, (int)ceil(max[0]));
+    int y0 = imax(0, (int)floor(min[1])), y1 = imin(im->height - 1, (int)ceil(max[1]));
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            double q[2] = { x + 0.5, y + 0.5 };
+            int pos = 0, neg = 0;
+            for (int j = 0; j < 4; j++)
+            {
+                double *a = p[j], *b = p[(j + 1) & 3];
+                double cross = (b[0] - a[0]) * (q[1] - a[1]) - (b[1] - a[1]) * (q[0] - a[0]);
+                pos |= cross > 0;
+                neg |= cross < 0;
+            }
+            if (!(pos && neg))
+                im->buf[y*im->stride + x] = value;
+        }
+    }
+}
+
+/* box blur of the given radius, horizontal pass into scratch, vertical pass back */
+static void box_blur(synth_sequence_t *seq, image_u8_t *im, int r)
+{
+    int width = im->width, height = im->height, n = 2*r + 1;
+
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t *row = &im->buf[y*im->stride];
+        for (int x = 0; x < width; x++)
+        {
+            int sum = 0;
+            for (int k = -r; k <= r; k++)
+                sum += row[iclamp(x + k, 0, width - 1)];
+            seq->scratch[y*width + x] = (sum + n/2) / n;
+        }
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            int sum = 0;
+            for (int k = -r; k <= r; k++)
+                sum += seq->scratch[iclamp(y + k, 0, height - 1)*width + x];
+            im->buf[y*im->stride + x] = (sum + n/2) / n;
+        }
+    }
+}
+
+/* one frame of motion, bouncing off the edges */
+static void move_anchors(synth_sequence_t *seq)
+{
+    double size[2] = { seq->params.width, seq->params.height };
+    for (int i = 0; i < seq->nanchors; i++)
+    {
+        synth_anchor_t *a = &seq->anchors[i];
+        for (int k = 0; k < 2; k++)
+        {
+            a->c[k] += a->v[k];
+            if ((a->c[k] < a->size && a->v[k] < 0) || (a->c[k] > size[k] - a->size && a->v[k] > 0))
+                a->v[k] = -a->v[k];
+        }
+        a->theta += a->omega;
+    }
+}
+
+void synth_sequence_render(synth_sequence_t *seq, image_u8_t *im)
+{
+    synth_params_t *params = &seq->params;
+    int f = seq->frame++;
+
+    if (f > 0)
+        move_anchors(seq);
+
+    for (int y = 0; y < im->height; y++)
+        memset(&im->buf[y*im->stride], params->background, im->width);
+
+    for (int i = 0; i < seq->nanchors; i++)
+    {
+        synth_anchor_t *a = &seq->anchors[i];
+        double r = a->size / sqrt(2);
+        for (int j = 0; j < 4; j++)
+        {
+            a->p[j][0] = a->c[0] + r * cos(a->theta + M_PI/4 + j*M_PI/2);
+            a->p[j][1] = a->c[1] + r * sin(a->theta + M_PI/4 + j*M_PI/2);
+        }
+
+        a->level = exposure(seq, a, f);
+        fill_quad(im, a->p, (uint8_t)lround(params->off + a->level * (params->on - params->off)));
+    }
+
+    if (params->noise > 0)
+    {
+        for (int y = 0; y < im->height; y++)
+        {
+            uint8_t *row = &im->buf[y*im->stride];
+            for (int x = 0; x < im->width; x++)
+                row[x] = iclamp((int)lround(row[x] + params->noise * next_gaussian(seq)), 0, 255);
+        }
+    }
+
+    if (params->blur > 0)
+        box_blur(seq, im, params->blur);
+}
+
+void synth_sequence_write_truth_header(FILE *f)
+{
+    fprintf(f, "frame,anchor,code,level,cx,cy,x0,y0,x1,y1,x2,y2,x3,y3\n");
+}
+
+void synth_sequence_write_truth(synth_sequence_t *seq, FILE *f)
+{
+    for (int i = 0; i < seq->nanchors; i++)
+    {
+        synth_anchor_t *a = &seq->anchors[i];
+        fprintf(f, "%d,%d,%u,%.3f,%.3f,%.3f", seq->frame - 1, i, a->code, a->level, a->c[0], a->c[1]);
+        for (int j = 0; j < 4; j++)
+            fprintf(f, ",%.3f,%.3f", a->p[j][0], a->p[j][1]);
+        fprintf(f, "\n");
+    }
+}
+
+void synth_sequence_destroy(synth_sequence_t *seq)
+{
+    if (seq == NULL)
+        return;
+
+    free(seq->anchors);
+    free(seq->scratch);
+    free(seq);
+}
@@ -0,0 +1,109 @@
+#ifndef _SYNTH_SEQUENCE_H_
+#define _SYNTH_SEQUENCE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "apriltag.h"
+
+/* what a synthetic sequence looks like, see synth_params_init() for the defaults */
+typedef struct synth_params synth_params_t;
+struct synth_params
+{
+    int width;
+    int height;
+
+    int nanchors;
+
+    // side length in pixels, each anchor gets size * (1 +- size_jitter)
+    double size;
+    double size_jitter;
+
+    // pixels per frame in a random direction, anchors bounce off the frame edges
+    double speed;
+    // radians per frame, in a random direction
+    double spin;
+
+    // gray levels of the background and of an anchor with its LED off and on
+    uint8_t background;
+    uint8_t off;
+    uint8_t on;
+
+    // standard deviation of per-pixel gaussian noise, radius of a box blur
+    double noise;
+    int blur;
+
+    // camera frames per code bit, 2 is the rate doubled codes assume;
+    // anything else makes exposures straddle bit edges
+    double frames_per_bit;
+
+    uint64_t seed;
+};
+
+/* ground truth of an anchor in the last rendered frame */
+typedef struct synth_anchor synth_anchor_t;
+struct synth_anchor
+{
+    uint32_t code;
+
+    // center, corners and how much of the exposure the LED was on, 0 to 1
+    double c[2];
+    double p[4][2];
+    double level;
+
+    // motion state
+    double v[2];
+    double theta;
+    double omega;
+    double size;
+
+    // frames into the code when the sequence starts
+    double phase;
+};
+
+/**
+ * Renders frames of anchors blinking registered codes, most significant bit
+ * first and each bit held for frames_per_bit frames, which is what the
+ * decoder's double_bits() words expect at the nominal rate. The sequence only
+ * depends on the parameters, so runs with the same seed are identical.
+ */
+typedef struct synth_sequence synth_sequence_t;
+struct synth_sequence
+{
+    synth_params_t params;
+    int code_width;
+
+    // next frame to render
+    int frame;
+
+    int nanchors;
+    synth_anchor_t *anchors;
+
+    uint64_t rng;
+
+    // one frame, for the horizontal blur pass
+    uint8_t *scratch;
+};
+
+void synth_params_init(synth_params_t *params);
+
+/**
+ * Places params->nanchors anchors, each blinking one of the codes picked at
+ * random, apart from each other where there is room.
+ */
+synth_sequence_t *synth_sequence_create(const synth_params_t *params,
+                                        const uint32_t *codes, int ncodes, int code_width);
+
+/**
+ * Renders the next frame into im, which must be params.width by params.height,
+ * and leaves that frame's ground truth in seq->anchors.
+ */
+void synth_sequence_render(synth_sequence_t *seq, image_u8_t *im);
+
+/** CSV header and one line per anchor for the last rendered frame. */
+void synth_sequence_write_truth_header(FILE *f);
+void synth_sequence_write_truth(synth_sequence_t *seq, FILE *f);
+
+void synth_sequence_destroy(synth_sequence_t *seq);
+
+#endif
@@ -34,6 +34,13 @@ export class GlitterDetector {
             thresDistShape: 50.0,
             thresDistShapeTTL: 20.0,
             thresDistCenter: 25.0,
+            codeWidth: 8,
+            // dispatch a CustomEvent per tag inside the worker instead of reading the packed results
+            tagEvents: false,
+            // gray from all three channels, the preprocessor's frames only need red
+            grayLuma: false,
+            // time the detector's stages, logged with printPerformance
+            collectStats: false,
         }
         this.setOptions(options);
 
@@ -87,11 +94,15 @@ export class GlitterDetector {
                 case "result": {
                     const tagEvent = new CustomEvent(
                         "onGlitterTagsFound",
-                        {detail: {tags: msg.tags}}
+                        {detail: {tags: msg.tags, lost: msg.lost}}
                     );
                     window.dispatchEvent(tagEvent);
                     break;
                 }
+                case "frame": {
+                    this.preprocessor.recycle(msg.imagedata);
+                    break;
+                }
                 case "resize": {
                     this.decimate();
                     break;
@@ -140,11 +151,13 @@ export class GlitterDetector {
         // console.log(start - this.prev, this.timer.getError());
         this.prev = start;
 
+        // transferred rather than cloned, the worker sends the buffer back once it is in the wasm heap
         this.imageData = this.preprocessor.getPixels();
         this.worker.postMessage({
             type: "process",
             imagedata: this.imageData
-        });
+        }, this.imageData ? [this.imageData.buffer] : []);
+        this.imageData = null;
 
         const end = Date.now();
 
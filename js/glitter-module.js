@@ -1,4 +1,28 @@
 import GlitterWASM from "../build/glitter_wasm";
+
+// layout of a result slot, see glitter/result_ring.h
+const RESULT_FRAME = 0;
+const RESULT_NDETECTIONS = 1;
+const RESULT_NLOST = 2;
+const RESULT_NDROPPED = 3;
+const RESULT_HEADER_INTS = 4;
+
+const RESULT_ID = 0;
+const RESULT_CODE = 1;
+const RESULT_STATE = 2;
+const RESULT_INTS = 4;
+
+const RESULT_CX = 0;
+const RESULT_CY = 1;
+const RESULT_P = 2;
+const RESULT_DOUBLES = 10;
+
+const RESULT_ACQUIRED = 0;
+
+// enum detector_stage and enum detector_counter, see glitter/detector_stats.h
+const STAGE_NAMES = ["quadThresh", "refineEdges", "homography", "association", "brightness", "decode"];
+const COUNTER_NAMES = ["quads", "candidates", "ttlCarries", "decodeHits", "decodeMisses", "allocations"];
+
 export class GlitterModule {
     constructor(codes, width, height, options, callback) {
         this.width = width;
@@ -28,30 +52,63 @@ export class GlitterModule {
 
         this._init = this._Module.cwrap("init", "number", ["number"]);
         this._add_code = this._Module.cwrap("add_code", "number", ["number"]);
+        this._set_code_width = this._Module.cwrap("set_code_width", "number", ["number"]);
 
         this._set_detector_options = this._Module.cwrap("set_detector_options", "number", ["number", "number", "number", "number", "number", "number"]);
         this._set_quad_decimate = this._Module.cwrap("set_quad_decimate", "number", ["number"]);
+        this._set_roi_tracking = this._Module.cwrap("set_roi_tracking", "number", ["number", "number", "number"]);
 
-        this._save_grayscale = this._Module.cwrap("save_grayscale", "number", ["number", "number", "number", "number"]);
+        this._set_gray_mode = this._Module.cwrap("set_gray_mode", "number", ["number"]);
+        this._save_frame = this._Module.cwrap("save_frame", "number", ["number", "number", "number", "number", "number", "number"]);
 
         this._detect_tags = this._Module.cwrap("detect_tags", "number", ["number", "number", "number"]);
+        this._set_tag_events = this._Module.cwrap("set_tag_events", "number", ["number"]);
+        this._get_results = this._Module.cwrap("get_results", "number", []);
+        this._get_result_capacity = this._Module.cwrap("get_result_capacity", "number", []);
+
+        this._set_collect_stats = this._Module.cwrap("set_collect_stats", "number", ["number"]);
+        this._reset_stats = this._Module.cwrap("reset_stats", "number", []);
+        this._get_stats_frames = this._Module.cwrap("get_stats_frames", "number", []);
+        this._get_stage_ns = this._Module.cwrap("get_stage_ns", "number", ["number"]);
+        this._get_counter = this._Module.cwrap("get_counter", "number", ["number"]);
 
         this.ready = (this._init() == 0);
         this.setDetectorOptions(this.options); // set default options
+        this.codeWidth = 8;
+        if (options.codeWidth && this._set_code_width(options.codeWidth) == 0) // before any code is added
+            this.codeWidth = options.codeWidth;
+        if (options.grayLuma)
+            this.setGrayLuma(true);
+        if (options.collectStats)
+            this.setCollectStats(true);
 
-        for (var i = 0; i < this.codes.length; i++) {
-            this._add_code(this.codes[i]);
+        // only the codes the detector accepted are kept
+        const codes = this.codes;
+        this.codes = [];
+        for (var i = 0; i < codes.length; i++) {
+            this.addCode(codes[i]);
         }
 
         this.imagePtr = this._Module._malloc(this.width * this.height * 4);
         this.grayPtr = this._Module._malloc(this.width * this.height);
 
         this.tags = [];
+        this.lostTags = [];
 
-        let _this = this;
-        this.scope.addEventListener("onGlitterTagFound", (e) => {
-            _this.tags.push(e.detail.tag);
-        });
+        this.resultCapacity = this._get_result_capacity();
+
+        // compatibility: one CustomEvent per tag, instead of reading the results in place
+        if (options.tagEvents) {
+            this._set_tag_events(1);
+
+            let _this = this;
+            this.scope.addEventListener("onGlitterTagFound", (e) => {
+                _this.tags.push(e.detail.tag);
+            });
+            this.scope.addEventListener("onGlitterTagLost", (e) => {
+                _this.lostTags.push(e.detail.tag);
+            });
+        }
     }
 
     resize(width, height) {
@@ -65,12 +122,12 @@ export class GlitterModule {
         this.grayPtr = this._Module._malloc(this.width * this.height);
     }
 
+    // false if the code does not fit the code width or the detector rejected it as a rotation of one already added
     addCode(code) {
-        if (0x00 < code < 0xff) {
-            this._add_code(code);
-            return this.codes.push(code);
-        }
-        return -1;
+        if (!(code > 0 && code < 2 ** this.codeWidth) || this._add_code(code) != 0)
+            return false;
+        this.codes.push(code);
+        return true;
     }
 
     setDetectorOptions(options) {
@@ -88,17 +145,140 @@ export class GlitterModule {
         return this._set_quad_decimate(factor);
     }
 
+    setRoiTracking(enable, fullEvery = 30, pad = 16) {
+        return this._set_roi_tracking(enable ? 1 : 0, fullEvery, pad);
+    }
+
+    /* weigh all three channels instead of only red, for frames that are not already gray */
+    setGrayLuma(enable) {
+        return this._set_gray_mode(enable ? 1 : 0);
+    }
+
+    /* time the detector's stages and count its work, read back with getStats() */
+    setCollectStats(enable) {
+        return this._set_collect_stats(enable ? 1 : 0);
+    }
+
+    resetStats() {
+        return this._reset_stats();
+    }
+
+    /*
+     * Sums since the last resetStats(): milliseconds per stage and counts per
+     * counter, along with the number of frames they cover. Everything stays
+     * zero unless setCollectStats(true) was called.
+     */
+    getStats() {
+        const stats = { frames: this._get_stats_frames(), stages: {}, counters: {} };
+        for (let i = 0; i < STAGE_NAMES.length; i++)
+            stats.stages[STAGE_NAMES[i]] = this._get_stage_ns(i) / 1e6;
+        for (let i = 0; i < COUNTER_NAMES.length; i++)
+            stats.counters[COUNTER_NAMES[i]] = this._get_counter(i);
+        return stats;
+    }
+
+    /*
+     * RGBA view of the module's input buffer in the wasm heap. A producer in
+     * this thread can read frames straight into it and pass it to
+     * saveGrayscale() without any copy. Like readResults(), it does not
+     * survive a heap resize, so get a new one every frame.
+     */
+    getFrameView() {
+        return new Uint8Array(this._Module.HEAPU8.buffer, this.imagePtr, this.width * this.height * 4);
+    }
+
+    /*
+     * Gray frame for detectTags(). pixels is RGBA, or one gray byte per pixel,
+     * and is copied into the wasm heap at most once: views of the heap from
+     * getFrameView() are converted in place and gray frames go straight to
+     * the gray buffer.
+     */
     saveGrayscale(pixels) {
-        this._Module.HEAPU8.set(pixels, this.imagePtr);
-        return this._save_grayscale(this.imagePtr, this.grayPtr, this.width, this.height);
+        const heap = this._Module.HEAPU8;
+        if (pixels.length == this.width * this.height) {
+            heap.set(pixels, this.grayPtr);
+            return 0;
+        }
+
+        let ptr = this.imagePtr;
+        if (pixels.buffer === heap.buffer)
+            ptr = pixels.byteOffset;
+        else
+            heap.set(pixels, this.imagePtr);
+        return this._save_frame(ptr, this.grayPtr, this.width, this.height, this.width * 4, 4);
+    }
+
+    /*
+     * Typed-array views of the last frame's results in the wasm heap, no copies.
+     * Records are the detections followed by the lost tracks: ints holds
+     * RESULT_INTS values per record (id, code, state), doubles RESULT_DOUBLES
+     * (center x/y, then corners x/y). The views stay valid for a few frames,
+     * but not across a heap resize, so make new ones every frame.
+     */
+    readResults() {
+        const ptr = this._get_results();
+        if (!ptr) return null;
+
+        const buffer = this._Module.HEAPU8.buffer;
+        const capacity = this.resultCapacity;
+        const header = new Int32Array(buffer, ptr, RESULT_HEADER_INTS);
+        const intsPtr = ptr + RESULT_HEADER_INTS * 4;
+        const doublesPtr = intsPtr + capacity * RESULT_INTS * 4;
+
+        return {
+            frame: header[RESULT_FRAME],
+            numDetections: header[RESULT_NDETECTIONS],
+            numLost: header[RESULT_NLOST],
+            numDropped: header[RESULT_NDROPPED],
+            ints: new Int32Array(buffer, intsPtr, capacity * RESULT_INTS),
+            doubles: new Float64Array(buffer, doublesPtr, capacity * RESULT_DOUBLES),
+        };
+    }
+
+    /* tag objects, in the same shape as the onGlitterTagFound/onGlitterTagLost events */
+    unpackResults(results) {
+        const ints = results.ints, doubles = results.doubles;
+        const n = results.numDetections + results.numLost;
+        for (let i = 0; i < n; i++) {
+            const rec = i * RESULT_INTS, pos = i * RESULT_DOUBLES;
+            const center = {x: doubles[pos + RESULT_CX], y: doubles[pos + RESULT_CY]};
+
+            if (i >= results.numDetections) {
+                this.lostTags.push({
+                    id: ints[rec + RESULT_ID] >>> 0,
+                    code: ints[rec + RESULT_CODE] >>> 0,
+                    center: center
+                });
+                continue;
+            }
+
+            const corners = [];
+            for (let j = 0; j < 4; j++) {
+                corners.push({
+                    x: doubles[pos + RESULT_P + 2*j],
+                    y: doubles[pos + RESULT_P + 2*j + 1]
+                });
+            }
+            this.tags.push({
+                id: ints[rec + RESULT_ID] >>> 0,
+                acquired: ints[rec + RESULT_STATE] == RESULT_ACQUIRED,
+                code: ints[rec + RESULT_CODE] >>> 0,
+                corners: corners,
+                center: center
+            });
+        }
     }
 
     detectTags() {
         this.tags = []; // reset found tags
+        this.lostTags = []; // and the tracks that ended
         if (!this.ready) return this.tags;
 
         this._detect_tags(this.grayPtr, this.width, this.height); // detect new tags
 
+        if (!this.options.tagEvents)
+            this.unpackResults(this.readResults());
+
         return this.tags;
     }
 }
@@ -64,13 +64,19 @@ function process() {
         const start = Date.now();
 
         glitterModule.saveGrayscale(next);
+        postMessage({type: "frame", imagedata: next}, [next.buffer]);
+        next = null;
         const tags = glitterModule.detectTags();
-        postMessage({type: "result", tags: tags});
+        postMessage({type: "result", tags: tags, lost: glitterModule.lostTags});
 
         const end = Date.now();
 
         if (glitterModule.options.printPerformance) {
             console.log("[performance]", "Detect:", end-start);
+            if (glitterModule.options.collectStats) {
+                console.log("[performance]", glitterModule.getStats());
+                glitterModule.resetStats();
+            }
         }
 
         if (glitterModule.options.decimateImage) {
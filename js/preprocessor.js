@@ -1,5 +1,8 @@
 import {GLUtils} from './utils/gl-utils';
 
+// frames in flight to the worker are at most this many
+const MAX_BUFFERS = 2;
+
 export class Preprocessor {
     constructor(width, height, canvas) {
         this.width = width;
@@ -36,15 +39,21 @@ export class Preprocessor {
         this.texture = GLUtils.createTexture(this.gl, this.width, this.height);
         GLUtils.bindTexture(this.gl, this.texture);
 
-        this.imageData = new Uint8Array(this.width * this.height * 4);
+        // frames handed back by recycle(), getPixels() reads into one of these when it can
+        this.buffers = [];
     }
 
+    /*
+     * Reads the current frame into a new or recycled buffer. The caller owns it
+     * and can transfer it to the worker, which gives it back through recycle().
+     */
     getPixels() {
         if (this.source) {
+            const pixels = this.buffers.pop() || new Uint8Array(this.width * this.height * 4);
             GLUtils.bindElem(this.gl, this.source);
             GLUtils.draw(this.gl);
-            GLUtils.readPixels(this.gl, this.width, this.height, this.imageData);
-            return this.imageData;
+            GLUtils.readPixels(this.gl, this.width, this.height, pixels);
+            return pixels;
         }
         else {
             return null;
@@ -90,7 +99,13 @@ export class Preprocessor {
         GLUtils.resize(this.gl);
         this.gl.uniform2f(this.textureSizeLocation, this.width, this.height);
 
-        this.imageData = new Uint8Array(this.width * this.height * 4);
+        this.buffers = [];
+    }
+
+    recycle(pixels) {
+        // frames of the previous size are dropped
+        if (pixels.length == this.width * this.height * 4 && this.buffers.length < MAX_BUFFERS)
+            this.buffers.push(pixels);
     }
 
     attachElem(source) {